@@ -0,0 +1,82 @@
+/*
+  The audio engine computes audio in blocks of a fixed, compile-time known count of frames,
+  independently of the count of frames requested by the audio callback, which varies
+  with the platform and the latency.
+
+  'FixedBlocks' adapts one to the other: frames computed in excess during an audio callback
+  are kept for the next audio callback.
+
+  This has two limits:
+  - Events that are not MIDI timestamped are applied at block boundaries, so they can be
+    up to 'audio_block_frames' - 1 frames late, compared to computing the audio callback buffer directly.
+  - The count of frames is passed to the audio engine as a runtime value: the kernels of the audio engine
+    are not specialized on it, the gain comes from the alignment of the blocks and from their
+    regular size.
+*/
+
+#ifdef __cplusplus
+
+#ifndef IMJ_AUDIO_BLOCK_FRAMES
+#  define IMJ_AUDIO_BLOCK_FRAMES 64
+#endif
+
+namespace imajuscule::audio {
+
+  static constexpr int audio_block_frames = IMJ_AUDIO_BLOCK_FRAMES;
+  static_assert(audio_block_frames > 0);
+
+  // the alignment of blocks, in bytes.
+  static constexpr int audio_block_alignment = 64;
+
+  /*
+  * The count of frames requested by the last audio callback.
+  */
+  std::atomic<int> & n_device_cb_frames();
+
+  inline uint64_t framesToNanos(int nFrames) {
+    return static_cast<uint64_t>(nFrames) * 1000000000 / SAMPLE_RATE;
+  }
+
+  /*
+  * Owned by the audio realtime thread.
+  */
+  template<int nOuts, int blockFrames>
+  struct FixedBlocks {
+    /*
+    * @param render : computes 'blockFrames' frames in an aligned buffer, using the audio engine.
+    * Its last argument is the offset of the first frame of the block, relative to 'buf'.
+    */
+    template<typename T, typename Render>
+    void step(T * buf, int nFrames, Render && render) {
+      static_assert(sizeof(T) <= sizeof(double));
+      n_device_cb_frames().store(nFrames, std::memory_order_relaxed);
+
+      T * block = reinterpret_cast<T*>(storage);
+
+      int offset = 0;
+
+      // frames computed during the previous callback
+      if(auto n = std::min(nFrames, nPending)) {
+        auto const from = block + (blockFrames - nPending) * nOuts;
+        std::copy(from, from + n * nOuts, buf);
+        nPending -= n;
+        offset += n;
+      }
+
+      while(offset < nFrames) {
+        render(block, blockFrames, offset);
+        auto const n = std::min(nFrames - offset, blockFrames);
+        std::copy(block, block + n * nOuts, buf + offset * nOuts);
+        nPending = blockFrames - n;
+        offset += n;
+      }
+    }
+
+  private:
+    int nPending = 0;
+    alignas(audio_block_alignment) unsigned char storage[nOuts * blockFrames * sizeof(double)];
+  };
+
+} // NS imajuscule::audio
+
+#endif
@@ -0,0 +1,287 @@
+/*
+  A tap on the final output of the audio engine (after the post-processing),
+  to record it or to visualize it.
+
+  The audio realtime thread copies the output to a single-producer, single-consumer ring buffer,
+  which is drained by a single reader: either the user of 'readOutputCapture_', or 'WavWriter'.
+  The reader owns the capture from the moment it enables it until it disables it,
+  and reads are mutually exclusive, so that the ring buffer never has two consumers.
+*/
+
+#ifdef __cplusplus
+
+namespace imajuscule::audio {
+
+  enum class CaptureReader {
+    None,
+    User, // see 'readOutputCapture_'
+    WavWriter
+  };
+
+  template<int nOuts>
+  struct OutputCapture {
+    // about 1.5 seconds at 44100 Hz
+    static constexpr int capacity_frames = 1 << 16;
+
+    /*
+    * Enables the capture, owned by 'r'. The frames captured previously are discarded.
+    *
+    * @returns false if the capture is owned by another reader.
+    */
+    bool enable(CaptureReader r) {
+      auto owner = CaptureReader::None;
+      if(!reader.compare_exchange_strong(owner, r, std::memory_order_acq_rel)) {
+        return owner == r;
+      }
+      {
+        // 'discard' is a consumer operation.
+        while(reading.exchange(true, std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+        ring.discard();
+        reading.store(false, std::memory_order_release);
+      }
+      enabled.store(true, std::memory_order_release);
+      return true;
+    }
+
+    /*
+    * Disables the capture, if it is owned by 'r'.
+    */
+    void disable(CaptureReader r) {
+      if(reader.load(std::memory_order_acquire) != r) {
+        return;
+      }
+      enabled.store(false, std::memory_order_release);
+      reader.store(CaptureReader::None, std::memory_order_release);
+    }
+
+    bool isEnabled() const {
+      return enabled.load(std::memory_order_acquire);
+    }
+
+    /*
+    * Called by the audio realtime thread. When the ring buffer is full,
+    * the frames that don't fit are dropped.
+    */
+    template<typename T>
+    void capture(T const * buf, int nFrames) {
+      if(!enabled.load(std::memory_order_relaxed)) {
+        return;
+      }
+      auto const n = std::min(nFrames, ring.countFree() / nOuts);
+      ring.write(buf, n * nOuts);
+      if(unlikely(n < nFrames)) {
+        nOverruns.fetch_add(1, std::memory_order_relaxed);
+        nDroppedFrames.fetch_add(nFrames - n, std::memory_order_relaxed);
+      }
+    }
+
+    /*
+    * Reads at most 'maxFrames' interleaved frames.
+    *
+    * @returns the count of frames read, or -1 if the capture is not owned by 'r',
+    * or if another thread is reading.
+    */
+    int read(CaptureReader r, float * buf, int maxFrames) {
+      if(reader.load(std::memory_order_acquire) != r) {
+        return -1;
+      }
+      if(reading.exchange(true, std::memory_order_acquire)) {
+        return -1;
+      }
+      int n = -1;
+      // the owner could have changed while we were acquiring 'reading'
+      if(reader.load(std::memory_order_acquire) == r) {
+        n = std::min(maxFrames, ring.countAvailable() / nOuts);
+        ring.read(buf, n * nOuts);
+      }
+      reading.store(false, std::memory_order_release);
+      return n;
+    }
+
+    // the count of audio callbacks during which frames were dropped because the reader was too slow
+    std::atomic<uint64_t> nOverruns{0};
+    // the total count of dropped frames
+    std::atomic<uint64_t> nDroppedFrames{0};
+
+  private:
+    std::atomic<bool> enabled{false};
+    std::atomic<CaptureReader> reader{CaptureReader::None};
+    // true while a consumer operation is in progress
+    std::atomic<bool> reading{false};
+    lockfree::SpscRing<float, capacity_frames * nOuts> ring;
+  };
+
+  // the size of the header written by 'writeWavHeader', excluding the first 8 bytes ("RIFF" and the size)
+  static constexpr uint32_t wav_header_riff_bytes = 4 + (8 + 40) + (8 + 4) + 8;
+
+  /*
+  * Writes the header of a wav file containing 32 bits float samples, using the extensible format
+  * ('WAVE_FORMAT_EXTENSIBLE' with an IEEE float subformat) and a fact chunk, as required
+  * for non-PCM data.
+  */
+  inline bool writeWavHeader(FILE * f, int nChannels, uint32_t nDataBytes) {
+    auto const u32 = [f](uint32_t v) {
+      uint8_t const b[4]{
+        static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 8),
+        static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 24)
+      };
+      return fwrite(b, 1, 4, f) == 4;
+    };
+    auto const u16 = [f](uint16_t v) {
+      uint8_t const b[2]{static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 8)};
+      return fwrite(b, 1, 2, f) == 2;
+    };
+    auto const tag = [f](char const * t) {
+      return fwrite(t, 1, 4, f) == 4;
+    };
+    constexpr uint16_t wave_format_extensible = 0xFFFE;
+    constexpr uint16_t bits = 32;
+    // KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+    constexpr uint8_t ieee_float_guid[16]{
+      0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+    };
+    // front center, or front left and front right
+    uint32_t const channelMask = (nChannels == 1) ? 0x4 : ((nChannels == 2) ? 0x3 : 0);
+    uint32_t const nFrames = nDataBytes / (nChannels * bits / 8);
+    return
+      tag("RIFF") && u32(wav_header_riff_bytes + nDataBytes) && tag("WAVE") &&
+      tag("fmt ") && u32(40) && u16(wave_format_extensible) && u16(nChannels) &&
+      u32(SAMPLE_RATE) && u32(SAMPLE_RATE * nChannels * bits / 8) && u16(nChannels * bits / 8) && u16(bits) &&
+      u16(22) && u16(bits) && u32(channelMask) && fwrite(ieee_float_guid, 1, 16, f) == 16 &&
+      tag("fact") && u32(4) && u32(nFrames) &&
+      tag("data") && u32(nDataBytes);
+  }
+
+  /*
+  * Drains an 'OutputCapture' from its own thread, and streams its frames to a wav file.
+  */
+  template<int nOuts>
+  struct WavWriter {
+    // how often the capture is drained
+    static constexpr auto period = std::chrono::milliseconds(20);
+    // the size of the RIFF chunk of a wav file is encoded on 32 bits
+    static constexpr uint64_t max_data_bytes = std::numeric_limits<uint32_t>::max() - wav_header_riff_bytes;
+
+    explicit WavWriter(OutputCapture<nOuts> & c)
+    : capture(c)
+    , buf(nOuts * OutputCapture<nOuts>::capacity_frames)
+    {}
+
+    /*
+    * Finalizes a recording that was not stopped: destroying a joinable thread
+    * would terminate the program (e.g. at static destruction).
+    */
+    ~WavWriter() {
+      stop();
+    }
+
+    /*
+    * Enables the capture, and starts writing it to 'path'.
+    *
+    * @returns false if a recording is already in progress, if the capture is read
+    * by the user, or if the file could not be created.
+    */
+    bool start(std::string const & path) {
+      std::lock_guard lock(startStopMutex);
+      if(thread.joinable()) {
+        return false;
+      }
+      if(!capture.enable(CaptureReader::WavWriter)) {
+        return false;
+      }
+      f = fopen(path.c_str(), "wb");
+      if(!f) {
+        LG(ERR, "WavWriter: could not open %s", path.c_str());
+        capture.disable(CaptureReader::WavWriter);
+        return false;
+      }
+      // the sizes are written when the recording stops
+      if(!writeWavHeader(f, nOuts, 0)) {
+        fclose(f);
+        f = nullptr;
+        capture.disable(CaptureReader::WavWriter);
+        return false;
+      }
+      nDataBytes = 0;
+      running = true;
+      thread = std::thread([this]() { run(); });
+      return true;
+    }
+
+    /*
+    * Writes the remaining captured frames, disables the capture and closes the file.
+    */
+    void stop() {
+      std::lock_guard lock(startStopMutex);
+      if(!thread.joinable()) {
+        return;
+      }
+      {
+        std::lock_guard l(sleepMutex);
+        running = false;
+      }
+      cv.notify_one();
+      thread.join();
+
+      drain();
+      capture.disable(CaptureReader::WavWriter);
+      if(fseek(f, 0, SEEK_SET) || !writeWavHeader(f, nOuts, static_cast<uint32_t>(nDataBytes))) {
+        LG(ERR, "WavWriter: could not finalize the wav file");
+      }
+      fclose(f);
+      f = nullptr;
+    }
+
+  private:
+    OutputCapture<nOuts> & capture;
+    std::vector<float> buf;
+    FILE * f = nullptr;
+    uint64_t nDataBytes = 0;
+
+    // protects 'start' and 'stop'
+    std::mutex startStopMutex;
+    std::atomic<bool> running{false};
+    std::mutex sleepMutex;
+    std::condition_variable cv;
+    std::thread thread;
+
+    void run() {
+      while(true) {
+        {
+          std::unique_lock l(sleepMutex);
+          cv.wait_for(l, period, [this]() { return !running.load(std::memory_order_acquire); });
+          if(!running) {
+            return;
+          }
+        }
+        drain();
+      }
+    }
+
+    void drain() {
+      while(auto const n = capture.read(CaptureReader::WavWriter, buf.data(), OutputCapture<nOuts>::capacity_frames)) {
+        if(n < 0) {
+          // we own the capture, so this is transient: a read of the user is in progress.
+          std::this_thread::yield();
+          continue;
+        }
+        auto const bytes = static_cast<uint64_t>(n) * nOuts * sizeof(float);
+        if(nDataBytes + bytes > max_data_bytes) {
+          // the file is full, the frames are dropped.
+          continue;
+        }
+        // the samples are written in the native byte order, which is little-endian on supported platforms.
+        if(fwrite(buf.data(), sizeof(float), n * nOuts, f) != static_cast<size_t>(n * nOuts)) {
+          LG(ERR, "WavWriter: write error");
+          continue;
+        }
+        nDataBytes += bytes;
+      }
+    }
+  };
+
+} // NS imajuscule::audio
+
+#endif
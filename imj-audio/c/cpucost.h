@@ -0,0 +1,163 @@
+/*
+  Per-instrument cpu accounting.
+
+  The audio engine computes all channels and the post-processing (reverb) in a single call,
+  so the cpu cost of individual instruments can't be measured directly: instead, the cost of
+  every audio block is measured with a cycle counter, and is attributed to groups of channels
+  (an instrument, the wind voices) proportionally to their estimated workload.
+  Hence only the total is measured, the per-group cycles are estimates.
+
+  The cost of the post-processing is estimated using the blocks during which no voice
+  is active.
+*/
+
+#ifdef __cplusplus
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#endif
+
+namespace imajuscule::audio {
+
+  /*
+  * Returns a monotonic count of cpu cycles (or nanoseconds, on platforms
+  * where the cycle counter is not available).
+  */
+  inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+  }
+
+  /*
+  * The workload of a group of channels is estimated as:
+  *   (count of held voices + 1 if a voice is being released) * count of harmonics
+  */
+  struct CostGroup {
+    // written by non realtime threads
+    std::atomic<int> nHeldVoices{0};
+    std::atomic<int> nHarmonics{1};
+    // in nanoseconds, since the steady clock epoch
+    std::atomic<int64_t> releasedUntil{0};
+
+    // written by the audio realtime thread: the cycles attributed to the group.
+    std::atomic<uint64_t> estimatedCycles{0};
+
+    void reset() {
+      nHeldVoices.store(0, std::memory_order_relaxed);
+      releasedUntil.store(0, std::memory_order_relaxed);
+      estimatedCycles.store(0, std::memory_order_relaxed);
+    }
+
+    void setHarmonics(int n) {
+      nHarmonics.store(std::max(1, n), std::memory_order_relaxed);
+    }
+
+    /*
+    * @param releaseSamples : the duration of the release of the voice.
+    */
+    void onRelease(std::chrono::steady_clock::time_point now, int releaseSamples) {
+      auto const until = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count() +
+        static_cast<int64_t>(releaseSamples) * 1000000000 / SAMPLE_RATE;
+      if(until > releasedUntil.load(std::memory_order_relaxed)) {
+        releasedUntil.store(until, std::memory_order_relaxed);
+      }
+    }
+
+    int weight(int64_t nowNanos) const {
+      int n = nHeldVoices.load(std::memory_order_relaxed);
+      if(nowNanos < releasedUntil.load(std::memory_order_relaxed)) {
+        ++n;
+      }
+      return n * nHarmonics.load(std::memory_order_relaxed);
+    }
+  };
+
+  static constexpr int max_cost_groups = 512;
+
+  struct CpuCosts {
+    std::array<CostGroup, max_cost_groups> groups;
+    // protects 'used'
+    std::mutex m;
+    std::array<bool, max_cost_groups> used{};
+    // the groups with an index greater than or equal to this are not used.
+    std::atomic<int> nGroups{0};
+
+    // cycles spent computing audio blocks
+    std::atomic<uint64_t> totalCycles{0};
+    // cycles attributed to the post-processing
+    std::atomic<uint64_t> estimatedPostCycles{0};
+  };
+
+  CpuCosts & cpuCosts();
+
+  /*
+  * Returns -1 if all groups are used.
+  */
+  int allocateCostGroup();
+  void releaseCostGroup(int group);
+
+  /*
+  * Returns nullptr if the group is -1.
+  */
+  inline CostGroup * getCostGroup(int group) {
+    if(group < 0) {
+      return nullptr;
+    }
+    return &cpuCosts().groups[group];
+  }
+
+  /*
+  * Owned by the audio realtime thread.
+  */
+  struct CpuCostMeter {
+    // the weight of the last block in the moving average of the post-processing cost
+    static constexpr double smoothing = 0.05;
+
+    /*
+    * @param f : computes an audio block.
+    */
+    template<typename F>
+    void step(F && f) {
+      auto const start = readCycles();
+      f();
+      auto const cycles = readCycles() - start;
+
+      auto & c = cpuCosts();
+      c.totalCycles.fetch_add(cycles, std::memory_order_relaxed);
+
+      auto const nowNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+      int const nGroups = c.nGroups.load(std::memory_order_acquire);
+      int64_t sumWeights = 0;
+      for(int i=0; i<nGroups; ++i) {
+        weights[i] = c.groups[i].weight(nowNanos);
+        sumWeights += weights[i];
+      }
+
+      if(sumWeights == 0) {
+        postEstimate += smoothing * (cycles - postEstimate);
+        c.estimatedPostCycles.fetch_add(cycles, std::memory_order_relaxed);
+        return;
+      }
+      auto const post = std::min(cycles, static_cast<uint64_t>(postEstimate));
+      c.estimatedPostCycles.fetch_add(post, std::memory_order_relaxed);
+      auto const remaining = cycles - post;
+      for(int i=0; i<nGroups; ++i) {
+        if(weights[i]) {
+          c.groups[i].estimatedCycles.fetch_add(remaining * weights[i] / sumWeights, std::memory_order_relaxed);
+        }
+      }
+    }
+
+  private:
+    double postEstimate = 0.;
+    std::array<int, max_cost_groups> weights;
+  };
+
+} // NS imajuscule::audio
+
+#endif
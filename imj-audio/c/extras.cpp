@@ -9,11 +9,6 @@ namespace imajuscule::audio {
     return c;
   }
 
-  XFadeChans *& getXfadeChannels() {
-    static XFadeChans * p = nullptr;
-    return p;
-  }
-
   Event mkNoteOn(int pitch, float velocity) {
     Event e;
     e.type = Event::kNoteOnEvent;
@@ -37,15 +32,441 @@ namespace imajuscule::audio {
     return e;
   }
 
-  VoiceWindImpl & windVoice()
-  {
-    static constexpr auto n_mnc = VoiceWindImpl::n_channels;
-    using mnc_buffer = VoiceWindImpl::MonoNoteChannel::buffer_t;
-    static std::array<mnc_buffer, n_mnc> buffers;
-    static VoiceWindImpl v(buffers);
+  // the velocity of the note offs sent by 'mkNoteOff' is 0.
+  static constexpr float forced_note_off_velocity = -1.f;
+
+  Event mkForcedNoteOff(int pitch) {
+    Event e = mkNoteOff(pitch);
+    e.noteOff.velocity = forced_note_off_velocity;
+    return e;
+  }
+
+  bool isForcedNoteOff(Event const & e) {
+    return e.type == Event::kNoteOffEvent && e.noteOff.velocity == forced_note_off_velocity;
+  }
+
+  std::atomic<VoiceStealing> & voiceStealing() {
+    static std::atomic<VoiceStealing> p(VoiceStealing::None);
+    return p;
+  }
+
+  std::atomic<bool> & requestTabulatedEnvelopes() {
+    static std::atomic<bool> b(false);
+    return b;
+  }
+
+  bool & tabulatedEnvelopes() {
+    static bool b(false);
+    return b;
+  }
+
+  std::atomic<int> & maxVoicesPerInstrument() {
+    static std::atomic<int> n(0);
+    return n;
+  }
+
+  std::atomic<int> & n_device_cb_frames() {
+    static std::atomic<int> n(0);
+    return n;
+  }
+
+  IdleStats & idleStats() {
+    static IdleStats s;
+    return s;
+  }
+
+  std::atomic<uint64_t> & countEngineEvents() {
+    static std::atomic<uint64_t> n(0);
+    return n;
+  }
+
+  bool WindVoices::initialize(int nVoices) {
+    std::lock_guard l(m);
+    Assert(voices.empty());
+    notes.clear();
+    notes.reserve(128);
+    costGroup = allocateCostGroup();
+    if(auto * g = getCostGroup(costGroup)) {
+      g->setHarmonics(wind_voice_cost);
+    }
+    for(int i=0; i<nVoices; ++i) {
+      // add a single Xfade channel (for 'SoundEngine' and 'Channel' that don't support envelopes entirely)
+      static constexpr auto n_max_orchestrator_per_channel = 1;
+      auto [xfadeChan, _] = getAudioContext().getChannelHandler().getChannels().getChannelsXFade().emplace_front(
+        getAudioContext().getChannelHandler().get_lock_policy(),
+        std::numeric_limits<uint8_t>::max(),
+        n_max_orchestrator_per_channel);
+
+      auto v = std::make_unique<WindVoice>();
+      v->voice.initializeSlow();
+      if(!v->voice.initialize(xfadeChan)) {
+        LG(ERR,"WindVoice::initialize failed");
+        return false;
+      }
+      v->chans = &xfadeChan;
+      voices.push_back(std::move(v));
+    }
+    return true;
+  }
+
+  void WindVoices::finalize() {
+    std::lock_guard l(m);
+    for(auto & v : voices) {
+      v->voice.finalize();
+    }
+    voices.clear();
+    notes.clear();
+    releaseCostGroup(costGroup);
+    costGroup = -1;
+  }
+
+  int WindVoices::findNote(int16_t pitch) const {
+    for(int i=0, sz=notes.size(); i<sz; ++i) {
+      if(notes[i].pitch == pitch) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  onEventResult WindVoices::noteOn(int program, int16_t pitch, float velocity) {
+    onEngineEvent();
+    std::lock_guard l(m);
+    if(unlikely(voices.empty())) {
+      return onEventResult::DROPPED_NOTE;
+    }
+    int iVoice;
+    if(auto i = findNote(pitch); i >= 0) {
+      iVoice = notes[i].voice;
+    }
+    else {
+      auto it = std::min_element(voices.begin(), voices.end(), [](auto const & a, auto const & b) {
+        return a->nNotes < b->nNotes;
+      });
+      iVoice = std::distance(voices.begin(), it);
+    }
+    auto & v = *voices[iVoice];
+    auto voicing = Voicing(program,pitch,velocity,0.f,true,0);
+    auto res = playOneThing(v.voice,getAudioContext().getChannelHandler(),*v.chans,voicing);
+    if(res == onEventResult::OK) {
+      ++v.nNotes;
+      notes.push_back({pitch, iVoice});
+      if(auto * g = getCostGroup(costGroup)) {
+        g->nHeldVoices.store(notes.size(), std::memory_order_relaxed);
+      }
+    }
+    return res;
+  }
+
+  onEventResult WindVoices::noteOff(int16_t pitch) {
+    onEngineEvent();
+    std::lock_guard l(m);
+    auto i = findNote(pitch);
+    if(i < 0) {
+      return onEventResult::DROPPED_NOTE;
+    }
+    auto & v = *voices[notes[i].voice];
+    notes.erase(notes.begin() + i);
+    --v.nNotes;
+    if(auto * g = getCostGroup(costGroup)) {
+      g->nHeldVoices.store(notes.size(), std::memory_order_relaxed);
+      g->onRelease(std::chrono::steady_clock::now(), wind_release_samples);
+    }
+    return stopPlaying(v.voice,getAudioContext().getChannelHandler(),*v.chans,pitch);
+  }
+
+  uint64_t WindVoices::countEstimatedCycles() {
+    std::lock_guard l(m);
+    if(auto * g = getCostGroup(costGroup)) {
+      return g->estimatedCycles.load(std::memory_order_relaxed);
+    }
+    return 0;
+  }
+
+  WindVoices & windVoices() {
+    static WindVoices v;
     return v;
   }
 
+  std::atomic<int> & countWindVoices() {
+    static std::atomic<int> n(4);
+    return n;
+  }
+
+  bool RegisteredInstrument::operator == (RegisteredInstrument const & o) const {
+    if(kind != o.kind) {
+      return false;
+    }
+    if(kind == Kind::Wind) {
+      return program == o.program;
+    }
+    return
+      osc == o.osc &&
+      release == o.release &&
+      !(envelope < o.envelope) &&
+      !(o.envelope < envelope) &&
+      harmonics.size() == o.harmonics.size() &&
+      std::equal(harmonics.begin(), harmonics.end(), o.harmonics.begin(), [](auto const & a, auto const & b) {
+        return a.phase == b.phase && a.volume == b.volume;
+      });
+  }
+
+  namespace {
+    struct InstrumentsRegistry {
+      // protects the writes to 'instruments' and 'count'
+      std::mutex m;
+      std::array<std::unique_ptr<RegisteredInstrument>, max_registered_instruments> instruments;
+      std::atomic<int> count{0};
+    };
+
+    InstrumentsRegistry & instrumentsRegistry() {
+      static InstrumentsRegistry r;
+      return r;
+    }
+  }
+
+  int registerInstrument(RegisteredInstrument i) {
+    auto & r = instrumentsRegistry();
+    std::lock_guard l(r.m);
+    int const n = r.count.load(std::memory_order_relaxed);
+    for(int h=0; h<n; ++h) {
+      if(*r.instruments[h] == i) {
+        return h;
+      }
+    }
+    if(n == max_registered_instruments) {
+      LG(ERR, "registerInstrument: too many instruments");
+      return -1;
+    }
+    r.instruments[n] = std::make_unique<RegisteredInstrument>(std::move(i));
+    // publishes the instrument to 'registeredInstrument'
+    r.count.store(n+1, std::memory_order_release);
+    return n;
+  }
+
+  RegisteredInstrument const * registeredInstrument(int handle) {
+    auto & r = instrumentsRegistry();
+    if(handle < 0 || handle >= r.count.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return r.instruments[handle].get();
+  }
+
+  NoteEventsQueue & noteEventsQueue() {
+    static NoteEventsQueue q;
+    return q;
+  }
+
+  DeferredNoteOns & deferredNoteOns() {
+    static DeferredNoteOns d;
+    return d;
+  }
+
+  OutputCapture<nAudioOuts> & outputCapture() {
+    static OutputCapture<nAudioOuts> c;
+    return c;
+  }
+
+  WavWriter<nAudioOuts> & wavWriter() {
+    static WavWriter<nAudioOuts> w(outputCapture());
+    return w;
+  }
+
+  OutputLevels<nAudioOuts> & outputLevels() {
+    static OutputLevels<nAudioOuts> l;
+    return l;
+  }
+
+  MidiInput & midiInput() {
+    static MidiInput i;
+    return i;
+  }
+
+  CpuCosts & cpuCosts() {
+    static CpuCosts c;
+    return c;
+  }
+
+  int allocateCostGroup() {
+    auto & c = cpuCosts();
+    std::lock_guard l(c.m);
+    for(int i=0; i<max_cost_groups; ++i) {
+      if(c.used[i]) {
+        continue;
+      }
+      c.used[i] = true;
+      c.groups[i].reset();
+      c.groups[i].setHarmonics(1);
+      if(i >= c.nGroups.load(std::memory_order_relaxed)) {
+        c.nGroups.store(i+1, std::memory_order_release);
+      }
+      return i;
+    }
+    LG(WARN, "allocateCostGroup: no cost group available");
+    return -1;
+  }
+
+  void releaseCostGroup(int group) {
+    if(group < 0) {
+      return;
+    }
+    auto & c = cpuCosts();
+    std::lock_guard l(c.m);
+    // the realtime thread doesn't attribute cycles to a group with no voice.
+    c.groups[group].reset();
+    c.used[group] = false;
+  }
+
+  void getEngineCycles(uint64_t & total, uint64_t & estimatedPost, uint64_t & estimatedWind) {
+    auto & c = cpuCosts();
+    total = c.totalCycles.load(std::memory_order_relaxed);
+    estimatedPost = c.estimatedPostCycles.load(std::memory_order_relaxed);
+    estimatedWind = windVoices().countEstimatedCycles();
+  }
+
+  CallbackLoad & callbackLoad() {
+    static CallbackLoad l;
+    return l;
+  }
+
+  int countPlayedHarmonics(harmonicProperties_t const * hars, int n, int harmonicsLevel) {
+    if(harmonicsLevel <= 0 || n <= 1) {
+      return n;
+    }
+    auto const & limit = harmonics_limits[std::min(harmonicsLevel, static_cast<int>(harmonics_limits.size()) - 1)];
+    float loudest = 0.f;
+    for(int i=0; i<n; ++i) {
+      loudest = std::max(loudest, std::abs(hars[i].volume));
+    }
+    int played = std::min(n, limit.maxCount);
+    while(played > 1 && std::abs(hars[played-1].volume) < limit.minVolume * loudest) {
+      --played;
+    }
+    return played;
+  }
+
+  void CpuGovernor::enable(bool b) {
+    {
+      std::lock_guard l(sleepMutex);
+      enabled = b;
+    }
+    cv.notify_one();
+  }
+
+  void CpuGovernor::start() {
+    Assert(!thread.joinable());
+    currentLevel = 0;
+    startTime = Clock::now();
+    {
+      // the adjustments are counted since the initialization of the audio output
+      std::lock_guard l(adjustmentsMutex);
+      nAdjustments = 0;
+      adjustments.fill({});
+    }
+    callbackLoad().takePeak();
+    running = true;
+    thread = std::thread([this]() { run(); });
+  }
+
+  void CpuGovernor::stop() {
+    if(!thread.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard l(sleepMutex);
+      running = false;
+    }
+    cv.notify_one();
+    thread.join();
+  }
+
+  void CpuGovernor::run() {
+    auto lastDegradation = Clock::now() - min_degradation_interval;
+    auto lowLoadSince = Clock::now();
+    while(true) {
+      bool isEnabled;
+      {
+        std::unique_lock l(sleepMutex);
+        if(!enabled) {
+          cv.wait(l, [this]() { return !running || enabled; });
+          if(!running) {
+            return;
+          }
+          // the load measured while the governor was disabled is not relevant
+          callbackLoad().takePeak();
+          lowLoadSince = Clock::now();
+        }
+        cv.wait_for(l, period, [this]() { return !running || !enabled; });
+        if(!running) {
+          return;
+        }
+        isEnabled = enabled;
+      }
+      auto & load = callbackLoad();
+      float const average = load.average.load(std::memory_order_relaxed);
+      float const peak = load.takePeak();
+      auto const now = Clock::now();
+      int const l = level();
+
+      if(!isEnabled) {
+        if(l != 0) {
+          setLevel(0, average, peak);
+        }
+      }
+      else if(average > high_average_load || peak > high_peak_load) {
+        lowLoadSince = now;
+        if(l + 1 < static_cast<int>(quality_levels.size()) && now - lastDegradation >= min_degradation_interval) {
+          setLevel(l + 1, average, peak);
+          lastDegradation = now;
+        }
+      }
+      else if(average < low_average_load && peak < low_peak_load) {
+        if(l > 0 && now - lowLoadSince >= restore_after) {
+          setLevel(l - 1, average, peak);
+          lowLoadSince = now;
+        }
+      }
+      else {
+        lowLoadSince = now;
+      }
+    }
+  }
+
+  void CpuGovernor::setLevel(int l, float average, float peak) {
+    int const from = currentLevel.exchange(l, std::memory_order_relaxed);
+    LG(INFO, "cpu governor: quality level %d -> %d (average load %f, peak load %f)", from, l, average, peak);
+    {
+      std::lock_guard lock(adjustmentsMutex);
+      adjustments[nAdjustments % n_max_adjustments] = {
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - startTime).count()),
+        from,
+        l,
+        average,
+        peak
+      };
+      ++nAdjustments;
+    }
+  }
+
+  uint64_t CpuGovernor::countAdjustments() {
+    std::lock_guard l(adjustmentsMutex);
+    return nAdjustments;
+  }
+
+  bool CpuGovernor::getAdjustment(uint64_t index, GovernorAdjustment & a) {
+    std::lock_guard l(adjustmentsMutex);
+    if(index >= nAdjustments || index + n_max_adjustments < nAdjustments) {
+      return false;
+    }
+    a = adjustments[index % n_max_adjustments];
+    return true;
+  }
+
+  CpuGovernor & cpuGovernor() {
+    static CpuGovernor g;
+    return g;
+  }
+
 } // NS imajuscule::audio
 
 #endif
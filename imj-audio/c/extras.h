@@ -12,6 +12,18 @@
 #include "compiler.prepro.h"
 #include "cpp.audio/include/public.h"
 
+#include <condition_variable>
+
+#include "idle.h"
+#include "blocks.h"
+#include "lockfree.h"
+#include "wakeup.h"
+#include "governor.h"
+#include "cpucost.h"
+#include "midibytes.h"
+#include "capture.h"
+#include "meter.h"
+
 #ifdef __cplusplus
 
 namespace imajuscule {
@@ -120,6 +132,31 @@ namespace imajuscule {
       static constexpr bool value = Rel == EnvelopeRelease::WaitForKeyRelease;
     };
 
+    template<typename Env>
+    struct AtomicityOf;
+
+    template<Atomicity A, typename T, EnvelopeRelease Rel>
+    struct AtomicityOf<AHDSREnvelope<A, T, Rel>> {
+      static constexpr auto value = A;
+    };
+
+    template<typename T>
+    struct NonAtomic {
+      NonAtomic(T v = {}) : v(v) {}
+      T load(std::memory_order = std::memory_order_seq_cst) const { return v; }
+      void store(T x, std::memory_order = std::memory_order_seq_cst) { v = x; }
+    private:
+      T v;
+    };
+
+    /*
+    * The state of an envelope is written by the thread sending note events, and read
+    * by the audio realtime thread: like the state of 'AHDSREnvelope', it is atomic
+    * unless the audio engine uses a global lock ('Atomicity::No').
+    */
+    template<Atomicity A, typename T>
+    using MaybeAtomic = std::conditional_t<A == Atomicity::Yes, std::atomic<T>, NonAtomic<T>>;
+
     template<typename Env>
     std::pair<std::vector<double>, int> envelopeGraphVec(typename Env::Param const & envParams) {
       Env e;
@@ -148,6 +185,420 @@ namespace imajuscule {
       }
       return {std::move(v),splitAt};
     }
+
+    /*
+    * The values of an analytic envelope, computed once for given envelope parameters,
+    * and shared by all voices using these parameters.
+    */
+    struct EnvelopeTable {
+      // see 'envelopeGraphVec'
+      std::vector<double> values;
+      int splitAt;
+
+      double sustain() const {
+        return (splitAt > 0) ? values[splitAt-1] : 0.;
+      }
+    };
+
+    /*
+    * Returns the (cached) table of the analytic envelope 'Env' for these parameters.
+    *
+    * A table is freed when no envelope uses it anymore.
+    */
+    template<typename Env>
+    std::shared_ptr<const EnvelopeTable> envelopeTable(typename Env::Param const & p) {
+      using Cache = std::map<typename Env::Param, std::weak_ptr<const EnvelopeTable>>;
+      static Cache cache;
+      static std::mutex m;
+
+      std::lock_guard l(m);
+      if(auto it = cache.find(p); it != cache.end()) {
+        if(auto t = it->second.lock()) {
+          return t;
+        }
+      }
+      for(auto it = cache.begin(); it != cache.end();) {
+        if(it->second.expired()) {
+          it = cache.erase(it);
+        }
+        else {
+          ++it;
+        }
+      }
+      auto [values, splitAt] = envelopeGraphVec<Env>(p);
+      auto t = std::make_shared<const EnvelopeTable>(EnvelopeTable{std::move(values), splitAt});
+      cache[p] = t;
+      return t;
+    }
+
+    /*
+    * An AHDSR envelope that reads the values of the corresponding analytic envelope ('AHDSREnvelope')
+    * in a table, instead of evaluating the attack, decay and release interpolations for every sample.
+    *
+    * The output is identical to the one of the analytic envelope, except when the key
+    * is released before the sustain phase is reached: in that case, the release values
+    * are scaled by (current value / sustain value), which closely approximates linear releases.
+    * Use 'tabulatedEnvelopeMaxError' to measure the difference with the analytic envelope.
+    */
+    template<Atomicity A, typename T, EnvelopeRelease Rel>
+    struct TabulatedAHDSREnvelope {
+      using Analytic = AHDSREnvelope<A, T, Rel>;
+      using FPT = T;
+      using Param = typename Analytic::Param;
+      static constexpr auto Release = Rel;
+
+      // Must not be called from the audio realtime thread.
+      void setAHDSR(Param const & p) {
+        table = envelopeTable<Analytic>(p);
+        phase.store(Phase::Done, std::memory_order_relaxed);
+        state.store(EnvelopeState::EnvelopeDone1, std::memory_order_relaxed);
+        current = 0;
+      }
+
+      void onKeyPressed(int32_t delay) {
+        countdown.store(delay, std::memory_order_relaxed);
+        state.store(EnvelopeState::KeyPressed, std::memory_order_relaxed);
+        // publishes 'countdown'
+        phase.store(Phase::WaitPress, std::memory_order_release);
+      }
+
+      void onKeyReleased(int32_t delay) {
+        if constexpr (Rel == EnvelopeRelease::ReleaseAfterDecay) {
+          return;
+        }
+        if(auto const p = phase.load(std::memory_order_acquire); p != Phase::WaitPress && p != Phase::Press) {
+          return;
+        }
+        releaseCountdown.store(delay, std::memory_order_relaxed);
+        // publishes 'releaseCountdown'
+        releasePending.store(true, std::memory_order_release);
+      }
+
+      void step() {
+        if(phase.load(std::memory_order_acquire) == Phase::Done) {
+          return;
+        }
+        if(releasePending.load(std::memory_order_acquire)) {
+          auto const c = releaseCountdown.load(std::memory_order_relaxed);
+          releaseCountdown.store(c - 1, std::memory_order_relaxed);
+          if(c <= 0) {
+            releasePending.store(false, std::memory_order_relaxed);
+            startRelease();
+          }
+        }
+        auto const & v = table->values;
+        switch(phase.load(std::memory_order_relaxed)) {
+          case Phase::WaitPress: {
+            auto const c = countdown.load(std::memory_order_relaxed);
+            if(c > 0) {
+              countdown.store(c - 1, std::memory_order_relaxed);
+              return;
+            }
+            idx.store(-1, std::memory_order_relaxed);
+            phase.store(Phase::Press, std::memory_order_relaxed);
+          }
+            [[fallthrough]];
+          case Phase::Press: {
+            auto const i = idx.load(std::memory_order_relaxed) + 1;
+            if constexpr (Rel == EnvelopeRelease::WaitForKeyRelease) {
+              if(i >= table->splitAt) {
+                // sustain
+                return;
+              }
+            }
+            if(i >= static_cast<int>(v.size())) {
+              finish();
+              return;
+            }
+            idx.store(i, std::memory_order_relaxed);
+            current = v[i];
+            return;
+          }
+          case Phase::Release: {
+            auto const i = idx.load(std::memory_order_relaxed) + 1;
+            if(i >= static_cast<int>(v.size())) {
+              finish();
+              return;
+            }
+            idx.store(i, std::memory_order_relaxed);
+            current = (scale >= 0) ?
+              scale * v[i] :
+              // the sustain is 0, we can't scale the release values.
+              releaseFrom * (v.size() - i) / static_cast<T>(v.size() - table->splitAt + 1);
+            return;
+          }
+          default:
+            return;
+        }
+      }
+
+      T value() const {
+        return current;
+      }
+
+      EnvelopeState getRelaxedState() const {
+        return state.load(std::memory_order_relaxed);
+      }
+
+      bool isEnvelopeFinished() const {
+        return getRelaxedState() == EnvelopeState::EnvelopeDone1;
+      }
+
+      bool afterAttackBeforeSustain() const {
+        auto const p = phase.load(std::memory_order_acquire);
+        return p == Phase::WaitPress ||
+          (p == Phase::Press && idx.load(std::memory_order_relaxed) + 1 < table->splitAt);
+      }
+
+    private:
+      enum class Phase {
+        WaitPress,
+        Press,
+        Release,
+        Done
+      };
+
+      std::shared_ptr<const EnvelopeTable> table;
+      // Like the state of 'AHDSREnvelope', the state shared with the thread sending
+      // note events is atomic when 'A' is 'Atomicity::Yes'.
+      MaybeAtomic<A, Phase> phase{Phase::Done};
+      MaybeAtomic<A, EnvelopeState> state{EnvelopeState::EnvelopeDone1};
+      MaybeAtomic<A, int> idx{-1};
+      MaybeAtomic<A, int32_t> countdown{0};
+      MaybeAtomic<A, int32_t> releaseCountdown{0};
+      MaybeAtomic<A, bool> releasePending{false};
+
+      // only used by the audio realtime thread
+      T current = 0;
+      T scale = 1;
+      T releaseFrom = 0;
+
+      void startRelease() {
+        if(phase.load(std::memory_order_relaxed) == Phase::WaitPress) {
+          // the key is released before the envelope started
+          finish();
+          return;
+        }
+        auto const sustain = table->sustain();
+        if(sustain > 1e-6) {
+          scale = current / sustain;
+        }
+        else {
+          scale = -1;
+          releaseFrom = current;
+        }
+        idx.store(table->splitAt - 1, std::memory_order_relaxed);
+        phase.store(Phase::Release, std::memory_order_relaxed);
+        state.store(EnvelopeState::KeyReleased, std::memory_order_relaxed);
+      }
+
+      void finish() {
+        current = 0;
+        phase.store(Phase::Done, std::memory_order_relaxed);
+        state.store(EnvelopeState::EnvelopeDone1, std::memory_order_relaxed);
+      }
+    };
+
+    template<Atomicity A, typename T, EnvelopeRelease Rel>
+    struct SetParam<TabulatedAHDSREnvelope<A, T, Rel>> : public SetParam<AHDSREnvelope<A, T, Rel>> {};
+
+    template<Atomicity A, typename T, EnvelopeRelease Rel>
+    struct HasNoteOff<TabulatedAHDSREnvelope<A, T, Rel>> : public HasNoteOff<AHDSREnvelope<A, T, Rel>> {};
+
+    template<Atomicity A, typename T, EnvelopeRelease Rel>
+    struct AtomicityOf<TabulatedAHDSREnvelope<A, T, Rel>> {
+      static constexpr auto value = A;
+    };
+
+    /*
+    * 'TabulatedAHDSREnvelope' is used by 'MultiEnveloped' in place of 'AHDSREnvelope':
+    * these checks only verify that it has the same types and member signatures.
+    */
+    template<typename Env, typename Ref>
+    constexpr bool hasEnvelopeInterfaceOf() {
+      using P = typename Ref::Param const &;
+      return
+        std::is_same_v<typename Env::FPT, typename Ref::FPT> &&
+        std::is_same_v<typename Env::Param, typename Ref::Param> &&
+        Env::Release == Ref::Release &&
+        std::is_same_v<decltype(std::declval<Env&>().setAHDSR(std::declval<P>())), decltype(std::declval<Ref&>().setAHDSR(std::declval<P>()))> &&
+        std::is_same_v<decltype(std::declval<Env&>().onKeyPressed(int32_t{})), decltype(std::declval<Ref&>().onKeyPressed(int32_t{}))> &&
+        std::is_same_v<decltype(std::declval<Env&>().onKeyReleased(int32_t{})), decltype(std::declval<Ref&>().onKeyReleased(int32_t{}))> &&
+        std::is_same_v<decltype(std::declval<Env&>().step()), decltype(std::declval<Ref&>().step())> &&
+        std::is_same_v<decltype(std::declval<Env const &>().value()), decltype(std::declval<Ref const &>().value())> &&
+        std::is_same_v<decltype(std::declval<Env const &>().getRelaxedState()), decltype(std::declval<Ref const &>().getRelaxedState())> &&
+        std::is_same_v<decltype(std::declval<Env const &>().afterAttackBeforeSustain()), decltype(std::declval<Ref const &>().afterAttackBeforeSustain())> &&
+        std::is_same_v<decltype(std::declval<Env const &>().isEnvelopeFinished()), bool>;
+    }
+
+    template<Atomicity A, EnvelopeRelease Rel>
+    constexpr bool tabulatedHasEnvelopeInterface() {
+      return hasEnvelopeInterfaceOf<TabulatedAHDSREnvelope<A, AudioFloat, Rel>, AHDSREnvelope<A, AudioFloat, Rel>>();
+    }
+    static_assert(tabulatedHasEnvelopeInterface<Atomicity::Yes, EnvelopeRelease::WaitForKeyRelease>());
+    static_assert(tabulatedHasEnvelopeInterface<Atomicity::Yes, EnvelopeRelease::ReleaseAfterDecay>());
+    static_assert(tabulatedHasEnvelopeInterface<Atomicity::No, EnvelopeRelease::WaitForKeyRelease>());
+    static_assert(tabulatedHasEnvelopeInterface<Atomicity::No, EnvelopeRelease::ReleaseAfterDecay>());
+
+    // 3 milliseconds: short enough to free the channel quickly, long enough to avoid a click.
+    static constexpr int32_t stolen_release_frames = SAMPLE_RATE * 3 / 1000;
+
+    /*
+    * An envelope that can be stolen: when the key is released by a forced note off
+    * (see 'mkForcedNoteOff'), the envelope fades out in 'stolen_release_frames' frames,
+    * instead of using the release of 'Env'. This also applies to 'ReleaseAfterDecay' envelopes,
+    * which otherwise ignore key releases.
+    *
+    * 'onKeyPressed' and 'onKeyReleased' are called by the thread sending the note events,
+    * while 'step' and 'value' are called by the audio realtime thread.
+    */
+    template<typename Env>
+    struct StealableEnvelope : public Env {
+      using FPT = typename Env::FPT;
+      static constexpr auto A = AtomicityOf<Env>::value;
+
+      /*
+      * 'forced' is set by the instrument while it sends a forced note off to the audio engine,
+      * which calls 'onKeyReleased' from the same thread.
+      */
+      void setForcedReleaseMarker(std::atomic<bool> const * forced) {
+        forcedRelease = forced;
+      }
+
+      void onKeyPressed(int32_t delay) {
+        fade.store(Fade::None, std::memory_order_relaxed);
+        stolenDone.store(false, std::memory_order_relaxed);
+        Env::onKeyPressed(delay);
+      }
+
+      void onKeyReleased(int32_t delay) {
+        if(forcedRelease && forcedRelease->load(std::memory_order_relaxed)) {
+          fadeCountdown.store(delay, std::memory_order_relaxed);
+          // publishes 'fadeCountdown'
+          fade.store(Fade::Pending, std::memory_order_release);
+          return;
+        }
+        Env::onKeyReleased(delay);
+      }
+
+      void step() {
+        Env::step();
+        switch(fade.load(std::memory_order_acquire)) {
+          case Fade::Pending:
+            if(auto const c = fadeCountdown.load(std::memory_order_relaxed); c > 0) {
+              fadeCountdown.store(c - 1, std::memory_order_relaxed);
+              return;
+            }
+            fadeIdx = 0;
+            fade.store(Fade::Active, std::memory_order_relaxed);
+            return;
+          case Fade::Active:
+            if(++fadeIdx >= stolen_release_frames) {
+              fade.store(Fade::Done, std::memory_order_relaxed);
+              stolenDone.store(true, std::memory_order_relaxed);
+            }
+            return;
+          default:
+            return;
+        }
+      }
+
+      FPT value() const {
+        switch(fade.load(std::memory_order_relaxed)) {
+          case Fade::Active:
+            return Env::value() * (stolen_release_frames - fadeIdx) / static_cast<FPT>(stolen_release_frames);
+          case Fade::Done:
+            return 0;
+          default:
+            return Env::value();
+        }
+      }
+
+      EnvelopeState getRelaxedState() const {
+        return stolenDone.load(std::memory_order_relaxed) ?
+          EnvelopeState::EnvelopeDone1 :
+          Env::getRelaxedState();
+      }
+
+      bool isEnvelopeFinished() const {
+        return getRelaxedState() == EnvelopeState::EnvelopeDone1;
+      }
+
+      bool afterAttackBeforeSustain() const {
+        return fade.load(std::memory_order_relaxed) == Fade::None && Env::afterAttackBeforeSustain();
+      }
+
+    private:
+      enum class Fade {
+        None,
+        Pending,
+        Active,
+        Done
+      };
+
+      std::atomic<bool> const * forcedRelease = nullptr;
+      MaybeAtomic<A, Fade> fade{Fade::None};
+      MaybeAtomic<A, int32_t> fadeCountdown{0};
+      // only used by the audio realtime thread
+      int32_t fadeIdx = 0;
+      MaybeAtomic<A, bool> stolenDone{false};
+    };
+
+    // stolen voices receive a note off, even in 'ReleaseAfterDecay' mode.
+    template<typename Env>
+    struct HasNoteOff<StealableEnvelope<Env>> {
+      static constexpr bool value = true;
+    };
+
+    /*
+    * Returns the maximum absolute difference between the values of the analytic and the tabulated
+    * envelopes, when the key is released at different moments of the attack, decay and sustain phases.
+    */
+    template<Atomicity A, typename T, EnvelopeRelease Rel>
+    double tabulatedEnvelopeMaxError(AHDSR const & p) {
+      using Analytic = AHDSREnvelope<A, T, Rel>;
+      using Tabulated = TabulatedAHDSREnvelope<A, T, Rel>;
+
+      auto const table = envelopeTable<Analytic>(p);
+      auto const n = static_cast<int>(table->values.size());
+      auto const split = std::max(1, table->splitAt);
+
+      std::vector<int> releaseAt;
+      if constexpr (Rel == EnvelopeRelease::WaitForKeyRelease) {
+        for(int i=1; i<=8; ++i) {
+          releaseAt.push_back((i * split) / 8);
+        }
+        // during sustain
+        releaseAt.push_back(split + 100);
+      }
+      else {
+        releaseAt.push_back(-1);
+      }
+
+      double maxError = 0.;
+      for(auto k : releaseAt) {
+        Analytic a;
+        Tabulated t;
+        a.setAHDSR(p);
+        t.setAHDSR(p);
+        a.onKeyPressed(0);
+        t.onKeyPressed(0);
+        for(int i=0; i < 2*n + 1000; ++i) {
+          if(i == k) {
+            a.onKeyReleased(0);
+            t.onKeyReleased(0);
+          }
+          a.step();
+          t.step();
+          maxError = std::max(maxError, std::abs(static_cast<double>(a.value()) - t.value()));
+          if(a.getRelaxedState() == EnvelopeState::EnvelopeDone1 &&
+             t.getRelaxedState() == EnvelopeState::EnvelopeDone1) {
+            break;
+          }
+        }
+      }
+      return maxError;
+    }
   }
 
   namespace audio {
@@ -160,12 +611,54 @@ namespace imajuscule {
     static constexpr auto audioEnginePolicy = AudioOutPolicy::MasterLockFree;
 #endif
 
-    using AllChans = ChannelsVecAggregate< 2, audioEnginePolicy >;
+    static constexpr int nAudioOuts = 2;
+
+    OutputCapture<nAudioOuts> & outputCapture();
+    WavWriter<nAudioOuts> & wavWriter();
+    OutputLevels<nAudioOuts> & outputLevels();
+
+    using AllChans = ChannelsVecAggregate< nAudioOuts, audioEnginePolicy >;
 
     using NoXFadeChans = typename AllChans::NoXFadeChans;
     using XFadeChans = typename AllChans::XFadeChans;
 
-    using ChannelHandler = outputDataBase< AllChans >;
+    /*
+    * Intercepts the audio callback of the audio engine, which calls 'step' from the
+    * audio realtime thread to compute the next output buffer.
+    */
+    struct ChannelHandler : public outputDataBase< AllChans > {
+      using Base = outputDataBase< AllChans >;
+      using Base::Base;
+
+      /*
+      * @param tNanos : the time of the first frame of 'outputBuffer'. The audio engine
+      * uses it to schedule MIDI timestamped events, so every block is computed with its own start time.
+      */
+      template<typename SAMPLE_T>
+      void step(SAMPLE_T * outputBuffer, int nFrames, uint64_t const tNanos) {
+        load.step(nFrames, [this, outputBuffer, nFrames, tNanos]() {
+          idle.step(outputBuffer, nFrames, [this, tNanos](SAMPLE_T * buf, int n) {
+            blocks.step(buf, n, [this, tNanos](SAMPLE_T * block, int nBlockFrames, int frameOffset) {
+              auto const blockNanos = tNanos + framesToNanos(frameOffset);
+              cost.step([this, block, nBlockFrames, blockNanos]() {
+                Base::step(block, nBlockFrames, blockNanos);
+              });
+            });
+          }, [this, outputBuffer, tNanos]() {
+            Base::step(outputBuffer, 0, tNanos);
+          });
+          meter.step(outputBuffer, nFrames, outputLevels());
+          outputCapture().capture(outputBuffer, nFrames);
+        });
+      }
+
+    private:
+      CallbackLoadMeter load;
+      CpuCostMeter cost;
+      LevelMeter<nAudioOuts> meter;
+      IdleDetector<nAudioOuts> idle;
+      FixedBlocks<nAudioOuts, audio_block_frames> blocks;
+    };
 
     using Ctxt = AudioOutContext<
       ChannelHandler,
@@ -175,33 +668,431 @@ namespace imajuscule {
 
     Ctxt & getAudioContext();
 
-    XFadeChans *& getXfadeChannels();
-
     Event mkNoteOn(int pitch, float velocity);
 
     Event mkNoteOff(int pitch);
 
+    /*
+    * A note off releasing a stolen voice: its envelope fades out in a few milliseconds,
+    * see 'StealableEnvelope'.
+    */
+    Event mkForcedNoteOff(int pitch);
+    bool isForcedNoteOff(Event const & e);
+
+    // in sync with the corresponding Haskell Enum instance
+    enum class VoiceStealing {
+      None,     // when an instrument has no free channel, the note is dropped.
+      Oldest,   // the voice that started first is released.
+      Quietest, // the voice with the lowest estimated envelope level is released.
+      SamePitch // a held voice of the same pitch is retriggered, else behaves like 'Oldest'
+                // when all channels are used.
+    };
+
+    std::atomic<VoiceStealing> & voiceStealing();
+
+    /*
+    * When true, instruments use 'TabulatedAHDSREnvelope' instead of 'AHDSREnvelope'.
+    *
+    * 'requestTabulatedEnvelopes' is taken into account at the next initialization,
+    * to make sure that a note off is sent to the instrument that played the note on.
+    */
+    std::atomic<bool> & requestTabulatedEnvelopes();
+    bool & tabulatedEnvelopes();
+
+    /*
+    * The maximum count of voices held simultaneously by a single instrument,
+    * or 0 to let the audio engine decide.
+    */
+    std::atomic<int> & maxVoicesPerInstrument();
+
+    /*
+    * The information needed to estimate the envelope level of a voice,
+    * without reading the envelope (which is owned by the audio realtime thread).
+    *
+    * Durations are in samples, and are the hints passed to the envelope, hence
+    * the estimated level is only an approximation.
+    */
+    struct VoiceEnvelopeHint {
+      int attack, hold, decay, release;
+      float sustain;
+      bool autoRelease;
+    };
+
+    /*
+    * The optional MIDI timestamp of a note event.
+    */
+    struct MaybeMIDITime {
+      // -1 when the event has no MIDI timestamp
+      int source;
+      // in nanoseconds
+      uint64_t time;
+
+      bool hasTime() const { return source >= 0; }
+
+      Optional<MIDITimestampAndSource> toEngine() const {
+        return hasTime() ?
+          Optional<MIDITimestampAndSource>{{time, static_cast<uint64_t>(source)}} :
+          Optional<MIDITimestampAndSource>{};
+      }
+    };
+
+    /*
+    * When a note event was sent to the audio engine.
+    */
+    struct NoteTime {
+      using Clock = std::chrono::steady_clock;
+
+      Clock::time_point sent;
+      MaybeMIDITime midi;
+
+      static NoteTime now(MaybeMIDITime const & midi) {
+        return {Clock::now(), midi};
+      }
+
+      /*
+      * Returns the count of samples between 'earlier' and this.
+      *
+      * When both events are MIDI timestamped, the MIDI timestamps are used: they are
+      * the times at which the audio engine plays the events, whereas the times at which
+      * the events were sent are subject to MIDI jitter.
+      */
+      int64_t samplesSince(NoteTime const & earlier) const {
+        if(midi.hasTime() && earlier.midi.hasTime()) {
+          auto const nanos = static_cast<int64_t>(midi.time - earlier.midi.time);
+          return nanos / 1000 * SAMPLE_RATE / 1000000;
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(sent - earlier.sent).count() * SAMPLE_RATE / 1000000;
+      }
+    };
+
+    struct VoiceStats {
+      int nHeld = 0;
+      int nSteals = 0;
+      int nDrops = 0;
+      // the cpu cycles attributed to the instrument, see 'CostGroup'
+      uint64_t estimatedCycles = 0;
+    };
+
+    /*
+    * Keeps track of the voices of an instrument that have been started
+    * and not yet released, to be able to chose which one should be stolen.
+    *
+    * Not thread-safe: the instrument lock (see 'Using') must be taken.
+    */
+    template<int N>
+    struct HeldVoices {
+      struct Voice {
+        int16_t pitch;
+        float velocity;
+        VoiceEnvelopeHint env;
+        NoteTime start;
+
+        // in samples, since the voice started
+        int64_t age(NoteTime const & now) const {
+          return now.samplesSince(start);
+        }
+
+        bool hasEnded(NoteTime const & now) const {
+          return env.autoRelease &&
+            age(now) > static_cast<int64_t>(env.attack) + env.hold + env.decay + env.release;
+        }
+
+        float estimateLevel(NoteTime const & now) const {
+          auto t = age(now);
+          float level;
+          if(t < env.attack) {
+            level = t / static_cast<float>(env.attack);
+          }
+          else if((t -= env.attack) < env.hold) {
+            level = 1.f;
+          }
+          else if((t -= env.hold) < env.decay) {
+            level = 1.f - (1.f - env.sustain) * t / static_cast<float>(env.decay);
+          }
+          else if(!env.autoRelease) {
+            level = env.sustain;
+          }
+          else if((t -= env.decay) < env.release) {
+            level = env.sustain * (1.f - t / static_cast<float>(env.release));
+          }
+          else {
+            level = 0.f;
+          }
+          return velocity * level;
+        }
+      };
+
+      int size() const { return n; }
+
+      void add(int16_t pitch, float velocity, VoiceEnvelopeHint const & env, NoteTime const & now) {
+        if(n == N) {
+          // the audio engine accepted more notes than we expected: forget the oldest one.
+          remove(0);
+        }
+        voices[n++] = Voice{pitch, velocity, env, now};
+      }
+
+      /*
+      * Releases the oldest voice of that pitch, if any.
+      *
+      * Voices in 'AutoRelease' mode ignore note off events, they are forgotten when they end.
+      */
+      void release(int16_t pitch) {
+        if(auto i = find(pitch); i >= 0 && !voices[i].env.autoRelease) {
+          remove(i);
+        }
+      }
+
+      void forgetEnded(NoteTime const & now) {
+        for(int i=n-1; i>=0; --i) {
+          if(voices[i].hasEnded(now)) {
+            remove(i);
+          }
+        }
+      }
+
+      void clear() { n = 0; }
+
+      /*
+      * Returns the index of the voice that should be stolen to play a note of pitch 'pitch',
+      * or -1 if no voice should be stolen.
+      *
+      * @param full : true when all the channels of the instrument are used.
+      * When false, a voice is stolen only to retrigger a held voice of the same pitch.
+      */
+      int pickVictim(VoiceStealing policy, int16_t pitch, NoteTime const & now, bool full) const {
+        if(!n || policy == VoiceStealing::None) {
+          return -1;
+        }
+        if(policy == VoiceStealing::SamePitch) {
+          if(auto i = find(pitch); i >= 0) {
+            return i;
+          }
+        }
+        if(!full) {
+          return -1;
+        }
+        if(policy != VoiceStealing::Quietest) {
+          // voices are ordered by start time.
+          return 0;
+        }
+        int victim = -1;
+        float minLevel = std::numeric_limits<float>::max();
+        for(int i=0; i<n; ++i) {
+          if(auto l = voices[i].estimateLevel(now); l < minLevel) {
+            minLevel = l;
+            victim = i;
+          }
+        }
+        return victim;
+      }
+
+      Voice const & operator[](int i) const { return voices[i]; }
+
+      void remove(int i) {
+        Assert(i >= 0 && i < n);
+        std::move(voices.begin() + i + 1, voices.begin() + n, voices.begin() + i);
+        --n;
+      }
+
+    private:
+      std::array<Voice, N> voices;
+      int n = 0;
+
+      int find(int16_t pitch) const {
+        for(int i=0; i<n; ++i) {
+          if(voices[i].pitch == pitch) {
+            return i;
+          }
+        }
+        return -1;
+      }
+    };
+
     template <typename Env, audioelement::OscillatorType Osc>
     using synthOf = vasine::Synth <
       Ctxt::policy
     , Ctxt::nAudioOut
     , XfadePolicy::SkipXfade
-    , audioelement::audioElementOf<Osc, Env>
-    , audioelement::HasNoteOff<Env>::value
+    , audioelement::audioElementOf<Osc, audioelement::StealableEnvelope<Env>>
+    , audioelement::HasNoteOff<audioelement::StealableEnvelope<Env>>::value
     , EventIterator<IEventList>
     , NoteOnEvent
     , NoteOffEvent>;
 
+    /*
+    * The instruments having deferred note ons (see 'withChannels::onEvent2').
+    *
+    * Deferred note ons are retried by the note events worker (see 'wakeUpNoteEventsWorker'),
+    * so that the threads sending notes never wait for a channel to be freed.
+    */
+    struct DeferredNoteOns {
+      // Retries the deferred note ons of an instrument, returns true when it has none anymore.
+      using Retry = bool (*)(void * instrument);
+
+      /*
+      * Never locks. An instrument must not be added again until its 'Retry' returned true.
+      *
+      * @returns false if there are too many instruments with deferred note ons.
+      */
+      bool add(void * instrument, Retry r) {
+        return inbox.tryPush(Entry{instrument, r});
+      }
+
+      /*
+      * Called by the note events worker.
+      *
+      * @returns true if some note ons are still deferred.
+      */
+      bool retry() {
+        Entry e;
+        while(inbox.tryPop(e)) {
+          entries.push_back(e);
+        }
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](Entry const & e) {
+          return e.retry(e.instrument);
+        }), entries.end());
+        return !entries.empty();
+      }
+
+      // Called when the note events worker stops, before the instruments are destroyed.
+      void clear() {
+        Entry e;
+        while(inbox.tryPop(e)) {
+        }
+        entries.clear();
+      }
+
+    private:
+      struct Entry {
+        void * instrument;
+        Retry retry;
+      };
+      lockfree::BoundedQueue<Entry, 1024> inbox;
+      // only used by the note events worker
+      std::vector<Entry> entries;
+    };
+
+    DeferredNoteOns & deferredNoteOns();
+
+    // Never locks.
+    void wakeUpNoteEventsWorker();
+
     template<typename T>
     struct withChannels {
-      withChannels(NoXFadeChans & chans) : chans(chans), obj(buffers) {}
+      withChannels(NoXFadeChans & chans) : chans(chans), obj(buffers), costGroup(allocateCostGroup()) {
+        obj.forEachElems([this](auto & e) {
+          e.algo.editEnvelope().setForcedReleaseMarker(&forcedRelease);
+        });
+      }
       ~withChannels() {
         std::lock_guard<std::mutex> l(isUsed); // see 'Using'
+        releaseCostGroup(costGroup);
       }
 
+      /*
+      * When the instrument has no free channel for a note on,
+      * a held voice is released (stolen) according to 'voiceStealing()'.
+      *
+      * The stolen voice fades out in a few milliseconds (see 'StealableEnvelope'),
+      * hence there is no audible click. Until the audio realtime thread frees the channel
+      * of the stolen voice, the note on is deferred: it is retried by the note events worker,
+      * and dropped if the channel is not freed in time.
+      */
       template<typename Out>
-      auto onEvent2(Event e, Out & out, Optional<MIDITimestampAndSource> maybeMts) {
-        return obj.onEvent2(e, out, chans, maybeMts);
+      onEventResult onEvent2(Event e, Out & out, MaybeMIDITime const & midi, VoiceEnvelopeHint const & env) {
+        auto const now = NoteTime::now(midi);
+        voices.forgetEnded(now);
+        retryDeferred(out);
+
+        if(e.type == Event::kNoteOffEvent) {
+          if(cancelDeferred(e.noteOff.pitch)) {
+            // the note on was never played.
+            return onEventResult::OK;
+          }
+          voices.release(e.noteOff.pitch);
+          onRelease(now, env);
+          return obj.onEvent2(e, out, chans, midi.toEngine());
+        }
+        if(e.type != Event::kNoteOnEvent) {
+          return obj.onEvent2(e, out, chans, midi.toEngine());
+        }
+
+        auto const pitch = static_cast<int16_t>(e.noteOn.pitch);
+        auto const policy = voiceStealing().load(std::memory_order_relaxed);
+        auto const isFull = [this]() {
+          return voices.size() + nDeferred >= maxHeldVoices();
+        };
+        int nStolen = 0;
+        if(policy == VoiceStealing::None) {
+          if(isFull()) {
+            ++stats.nDrops;
+            return onEventResult::DROPPED_NOTE;
+          }
+        }
+        else {
+          // a voice of the same pitch is retriggered even if a channel is free.
+          while(true) {
+            bool const full = isFull();
+            if(!full && nStolen) {
+              break;
+            }
+            if(!steal(voices.pickVictim(policy, pitch, now, full), now, out, midi)) {
+              break;
+            }
+            ++nStolen;
+          }
+        }
+
+        auto res = obj.onEvent2(e, out, chans, midi.toEngine());
+        if(res == onEventResult::DROPPED_NOTE && policy != VoiceStealing::None) {
+          // the channels are used by held voices, or by voices being released.
+          if(!nStolen && steal(voices.pickVictim(policy, pitch, now, true), now, out, midi)) {
+            ++nStolen;
+          }
+          if(nStolen && deferNoteOn(e, midi, env, now)) {
+            return onEventResult::OK;
+          }
+        }
+        if(res == onEventResult::OK) {
+          voices.add(pitch, e.noteOn.velocity, env, now);
+          updateCost();
+        }
+        else if(res == onEventResult::DROPPED_NOTE) {
+          ++stats.nDrops;
+        }
+        return res;
+      }
+
+      VoiceStats getStats() const {
+        auto s = stats;
+        s.nHeld = voices.size();
+        if(auto * g = getCostGroup(costGroup)) {
+          s.estimatedCycles = g->estimatedCycles.load(std::memory_order_relaxed);
+        }
+        return s;
+      }
+
+      // called when the instrument is recycled.
+      void resetStats() {
+        voices.clear();
+        stats = {};
+        if(auto * g = getCostGroup(costGroup)) {
+          g->reset();
+        }
+      }
+
+      // called when the harmonics of 'obj' are set.
+      void onHarmonics(int level, int count) {
+        harmonicsLevel = level;
+        if(auto * g = getCostGroup(costGroup)) {
+          g->setHarmonics(count);
+        }
+      }
+
+      // The instrument lock must be taken. An instrument with deferred note ons can't be recycled.
+      bool hasDeferredNoteOns() const {
+        return nDeferred > 0;
       }
 
       void finalize() {
@@ -212,9 +1103,159 @@ namespace imajuscule {
       NoXFadeChans & chans;
       std::mutex isUsed;
 
+      // the harmonics level that was used to set the harmonics of 'obj'
+      int harmonicsLevel = 0;
+      // see 'CostGroup', -1 if no cost group was available.
+      int const costGroup;
+
       static constexpr auto n_mnc = T::n_channels;
       using mnc_buffer = typename T::MonoNoteChannel::buffer_t;
       std::array<mnc_buffer,n_mnc> buffers;
+
+    private:
+      HeldVoices<n_mnc> voices;
+      VoiceStats stats;
+      // set while a forced note off is sent to the audio engine, see 'StealableEnvelope'
+      std::atomic<bool> forcedRelease{false};
+
+      // a note on waiting for the channel of a stolen voice
+      struct DeferredNoteOn {
+        Event e;
+        MaybeMIDITime midi;
+        VoiceEnvelopeHint env;
+        NoteTime time;
+        NoteTime::Clock::time_point deadline;
+      };
+      static constexpr int max_deferred_note_ons = 4;
+      std::array<DeferredNoteOn, max_deferred_note_ons> deferred;
+      int nDeferred = 0;
+      // true while the instrument is in 'deferredNoteOns()'
+      bool retried = false;
+
+      static int maxHeldVoices() {
+        int n = n_mnc;
+        if(auto m = maxVoicesPerInstrument().load(std::memory_order_relaxed); m > 0) {
+          n = std::min(n, m);
+        }
+        if(auto m = cpuGovernor().quality().maxVoices; m > 0) {
+          n = std::min(n, m);
+        }
+        return n;
+      }
+
+      void updateCost() {
+        if(auto * g = getCostGroup(costGroup)) {
+          g->nHeldVoices.store(voices.size(), std::memory_order_relaxed);
+        }
+      }
+
+      void onRelease(NoteTime const & now, int releaseSamples) {
+        updateCost();
+        if(auto * g = getCostGroup(costGroup)) {
+          g->onRelease(now.sent, releaseSamples);
+        }
+      }
+
+      void onRelease(NoteTime const & now, VoiceEnvelopeHint const & env) {
+        onRelease(now, env.release);
+      }
+
+      /*
+      * Releases the held voice 'i' with a forced note off, if 'i' is a valid index.
+      */
+      template<typename Out>
+      bool steal(int i, NoteTime const & now, Out & out, MaybeMIDITime const & midi) {
+        if(i < 0) {
+          return false;
+        }
+        // The note off uses the timestamp of the note on, so that they are ordered.
+        auto const e = mkForcedNoteOff(voices[i].pitch);
+        // The audio engine calls 'onKeyReleased' from this thread: 'forcedRelease'
+        // marks the note off as forced only for the duration of the call.
+        forcedRelease.store(isForcedNoteOff(e), std::memory_order_relaxed);
+        obj.onEvent2(e, out, chans, midi.toEngine());
+        forcedRelease.store(false, std::memory_order_relaxed);
+        voices.remove(i);
+        onRelease(now, audioelement::stolen_release_frames);
+        ++stats.nSteals;
+        return true;
+      }
+
+      /*
+      * The channel of a stolen voice is freed after 'audioelement::stolen_release_frames' frames,
+      * plus the latency of the audio realtime thread, plus the MIDI jitter when the note off is timestamped.
+      *
+      * @returns false if the note on could not be deferred.
+      */
+      bool deferNoteOn(Event const & e, MaybeMIDITime const & midi, VoiceEnvelopeHint const & env, NoteTime const & now) {
+        if(nDeferred == max_deferred_note_ons) {
+          return false;
+        }
+        if(!retried) {
+          if(!deferredNoteOns().add(this, &retryDeferredNoteOns)) {
+            return false;
+          }
+          retried = true;
+        }
+        auto const latencyFrames = std::max(n_device_cb_frames().load(std::memory_order_relaxed), audio_block_frames);
+        auto nanos = framesToNanos(audioelement::stolen_release_frames + 2 * latencyFrames);
+        if(midi.hasTime()) {
+          nanos += maxMIDIJitter();
+        }
+        deferred[nDeferred++] = DeferredNoteOn{e, midi, env, now, now.sent + std::chrono::nanoseconds(nanos)};
+        wakeUpNoteEventsWorker();
+        return true;
+      }
+
+      /*
+      * Plays the deferred note ons whose channel is free, and drops the ones that waited too long.
+      */
+      template<typename Out>
+      void retryDeferred(Out & out) {
+        auto const t = NoteTime::Clock::now();
+        for(int i=0; i<nDeferred;) {
+          auto const & d = deferred[i];
+          auto const res = obj.onEvent2(d.e, out, chans, d.midi.toEngine());
+          if(res == onEventResult::OK) {
+            voices.add(static_cast<int16_t>(d.e.noteOn.pitch), d.e.noteOn.velocity, d.env, d.time);
+            updateCost();
+          }
+          else if(res == onEventResult::DROPPED_NOTE && t <= d.deadline) {
+            ++i;
+            continue;
+          }
+          else {
+            ++stats.nDrops;
+            LG(WARN, "a note on was dropped: the channel of the stolen voice was not freed in time");
+          }
+          removeDeferred(i);
+        }
+      }
+
+      // @returns true if a deferred note on of that pitch was cancelled.
+      bool cancelDeferred(int pitch) {
+        for(int i=0; i<nDeferred; ++i) {
+          if(deferred[i].e.noteOn.pitch == pitch) {
+            removeDeferred(i);
+            return true;
+          }
+        }
+        return false;
+      }
+
+      void removeDeferred(int i) {
+        std::move(deferred.begin() + i + 1, deferred.begin() + nDeferred, deferred.begin() + i);
+        --nDeferred;
+      }
+
+      // see 'DeferredNoteOns::Retry'
+      static bool retryDeferredNoteOns(void * instrument) {
+        auto & i = *static_cast<withChannels *>(instrument);
+        std::lock_guard<std::mutex> l(i.isUsed);
+        i.retryDeferred(getAudioContext().getChannelHandler());
+        i.retried = i.nDeferred > 0;
+        return !i.retried;
+      }
     };
 
     // a 'Using' instance gives the guarantee that the object 'o' passed to its constructor
@@ -260,6 +1301,20 @@ namespace imajuscule {
       bool success;
     };
 
+    /*
+    * The harmonics of an instrument: all harmonics identify the instrument, but
+    * only the first 'played' harmonics are played, see 'countPlayedHarmonics'.
+    */
+    template<typename HarmonicsArray>
+    struct InstrumentHarmonics {
+      HarmonicsArray const & all;
+      HarmonicsArray const & played;
+      // the count of harmonics in 'played'
+      int count;
+      // the harmonics level used to compute 'played'
+      int level;
+    };
+
     template <typename Envel, audioelement::OscillatorType Osc>
     struct Synths {
       using T = synthOf<Envel, Osc>;
@@ -293,9 +1348,9 @@ namespace imajuscule {
       // and if the instrument lock is not taken, we have the guarantee that
       // the instrument lock won't be taken until we release the map lock.
       template<typename HarmonicsArray>
-      static Using<withChannels<T>> get(HarmonicsArray const & harmonics, EnvelParamT const & envelParam) {
+      static Using<withChannels<T>> get(InstrumentHarmonics<HarmonicsArray> const & harmonics, EnvelParamT const & envelParam) {
         using namespace audioelement;
-        K key{harmonics,envelParam};
+        K key{harmonics.all,envelParam};
 
         // we use a global lock because we can concurrently modify and lookup the map.
         std::lock_guard<std::mutex> l(map_mutex());
@@ -303,6 +1358,7 @@ namespace imajuscule {
         auto & synths = map();
         auto it = synths.find(key);
         if(it != synths.end()) {
+          updateHarmonics(*(it->second), harmonics, envelParam);
           return Using(std::move(l), *(it->second));
         }
         if(auto * p = recycleInstrument(synths, harmonics, envelParam, key)) {
@@ -310,7 +1366,8 @@ namespace imajuscule {
         }
         auto [c,remover] = addNoXfadeChannels(T::n_channels);
         auto p = std::make_unique<withChannels<T>>(c);
-        SetParam<Envel>::set(envelParam, harmonics, p->obj);
+        SetParam<Envel>::set(envelParam, harmonics.played, p->obj);
+        p->onHarmonics(harmonics.level, harmonics.count);
         if(!p->obj.initialize(p->chans)) {
           auto oneSynth = synths.begin();
           if(oneSynth != synths.end()) {
@@ -327,6 +1384,25 @@ namespace imajuscule {
           , *(synths.emplace(key, std::move(p)).first->second));
       }
 
+      /*
+      * Calls 'f' with the instrument, if it exists. Returns false if the
+      * instrument doesn't exist.
+      */
+      template<typename HarmonicsArray, typename F>
+      static bool withExisting(HarmonicsArray const & harmonics, EnvelParamT const & envelParam, F f) {
+        K key{harmonics,envelParam};
+
+        std::lock_guard<std::mutex> l(map_mutex());
+
+        auto & synths = map();
+        auto it = synths.find(key);
+        if(it == synths.end()) {
+          return false;
+        }
+        f(Using(std::move(l), *(it->second)).o);
+        return true;
+      }
+
       static void finalize() {
         std::lock_guard<std::mutex> l(map_mutex());
         for(auto & s : map()) {
@@ -347,9 +1423,31 @@ namespace imajuscule {
         return m;
       }
 
+      /*
+      * The caller is expected to take the map mutex.
+      *
+      * When the harmonics level has changed since the harmonics of the instrument were set,
+      * and if the instrument is not playing, sets the harmonics of the instrument again.
+      */
+      template<typename HarmonicsArray>
+      static void updateHarmonics(withChannels<T> & o, InstrumentHarmonics<HarmonicsArray> const & harmonics, EnvelParamT const & envelParam) {
+        if(o.harmonicsLevel == harmonics.level) {
+          return;
+        }
+        if(auto scoped = tryScopedLock(o.isUsed)) {
+          // see 'recycleInstrument'
+          if(o.chans.hasRealtimeFunctions()) {
+            return;
+          }
+          using namespace audioelement;
+          SetParam<Envel>::set(envelParam, harmonics.played, o.obj);
+          o.onHarmonics(harmonics.level, harmonics.count);
+        }
+      }
+
       /* The caller is expected to take the map mutex. */
       template<typename HarmonicsArray>
-      static withChannels<T> * recycleInstrument(Map & synths, HarmonicsArray const & harmonics, EnvelParamT const & envelParam, K const & key) {
+      static withChannels<T> * recycleInstrument(Map & synths, InstrumentHarmonics<HarmonicsArray> const & harmonics, EnvelParamT const & envelParam, K const & key) {
         for(auto it = synths.begin(), end = synths.end(); it != end; ++it) {
           auto & i = it->second;
           if(!i) {
@@ -360,7 +1458,7 @@ namespace imajuscule {
           if(auto scoped = tryScopedLock(o.isUsed)) {
             // we don't take the audio lock because 'hasRealtimeFunctions' relies on an
             // atomically incremented / decremented counter.
-            if(o.chans.hasRealtimeFunctions()) {
+            if(o.chans.hasRealtimeFunctions() || o.hasDeferredNoteOns()) {
               continue;
             }
 
@@ -384,7 +1482,9 @@ namespace imajuscule {
 
             Assert(isNew); // because prior to calling this function, we did a lookup
             using namespace audioelement;
-            SetParam<Envel>::set(envelParam, harmonics, inserted->second->obj);
+            SetParam<Envel>::set(envelParam, harmonics.played, inserted->second->obj);
+            inserted->second->resetStats();
+            inserted->second->onHarmonics(harmonics.level, harmonics.count);
             return inserted->second.get();
           }
           else {
@@ -410,38 +1510,207 @@ namespace imajuscule {
         static constexpr auto A = getAtomicity<audio::Ctxt::policy>();
         Synths<AHDSREnvelope<A, AudioFloat, EnvelopeRelease::WaitForKeyRelease>, O>::finalize();
         Synths<AHDSREnvelope<A, AudioFloat, EnvelopeRelease::ReleaseAfterDecay>, O>::finalize();
+        Synths<TabulatedAHDSREnvelope<A, AudioFloat, EnvelopeRelease::WaitForKeyRelease>, O>::finalize();
+        Synths<TabulatedAHDSREnvelope<A, AudioFloat, EnvelopeRelease::ReleaseAfterDecay>, O>::finalize();
       }
     };
 
     template<typename Env, audioelement::OscillatorType osc, typename HarmonicsArray>
-    onEventResult midiEvent(HarmonicsArray const & harmonics, typename Env::Param const & env, Event e, Optional<MIDITimestampAndSource> maybeMts) {
-      return Synths<Env, osc>::get(harmonics, env).o.onEvent2(e, getAudioContext().getChannelHandler(), maybeMts);
+    onEventResult midiEvent(InstrumentHarmonics<HarmonicsArray> const & harmonics, typename Env::Param const & env, Event e, MaybeMIDITime const & midi, VoiceEnvelopeHint const & hint) {
+      onEngineEvent();
+      return Synths<Env, osc>::get(harmonics, env).o.onEvent2(e, getAudioContext().getChannelHandler(), midi, hint);
     }
 
     template<typename Env, typename HarmonicsArray>
-    onEventResult midiEvent_(audioelement::OscillatorType osc, HarmonicsArray const & harmonics, typename Env::Param const & p, Event n, Optional<MIDITimestampAndSource> maybeMts) {
+    onEventResult midiEvent_(audioelement::OscillatorType osc, InstrumentHarmonics<HarmonicsArray> const & harmonics, typename Env::Param const & p, Event n, MaybeMIDITime const & midi, VoiceEnvelopeHint const & hint) {
       using namespace audioelement;
       switch(osc) {
         case OscillatorType::Saw:
-          return midiEvent<Env, OscillatorType::Saw, HarmonicsArray>(harmonics, p, n, maybeMts);
+          return midiEvent<Env, OscillatorType::Saw, HarmonicsArray>(harmonics, p, n, midi, hint);
         case OscillatorType::Square:
-          return midiEvent<Env, OscillatorType::Square, HarmonicsArray>(harmonics, p, n, maybeMts);
+          return midiEvent<Env, OscillatorType::Square, HarmonicsArray>(harmonics, p, n, midi, hint);
         case OscillatorType::Triangle:
-          return midiEvent<Env, OscillatorType::Triangle, HarmonicsArray>(harmonics, p, n, maybeMts);
+          return midiEvent<Env, OscillatorType::Triangle, HarmonicsArray>(harmonics, p, n, midi, hint);
         case OscillatorType::Sinus:
-          return midiEvent<Env, OscillatorType::Sinus, HarmonicsArray>(harmonics, p, n, maybeMts);
+          return midiEvent<Env, OscillatorType::Sinus, HarmonicsArray>(harmonics, p, n, midi, hint);
         case OscillatorType::SinusVolumeAdjusted:
-          return midiEvent<Env, OscillatorType::SinusVolumeAdjusted, HarmonicsArray>(harmonics, p, n, maybeMts);
+          return midiEvent<Env, OscillatorType::SinusVolumeAdjusted, HarmonicsArray>(harmonics, p, n, midi, hint);
         default:
           Assert(0);
           return onEventResult::DROPPED_NOTE;
       }
     }
 
+    template<typename Env, audioelement::OscillatorType osc, typename HarmonicsArray>
+    bool voiceStats(HarmonicsArray const & harmonics, typename Env::Param const & env, VoiceStats & stats) {
+      return Synths<Env, osc>::withExisting(harmonics, env, [&stats](auto & i) {
+        stats = i.getStats();
+      });
+    }
+
+    template<typename Env, typename HarmonicsArray>
+    bool voiceStats_(audioelement::OscillatorType osc, HarmonicsArray const & harmonics, typename Env::Param const & p, VoiceStats & stats) {
+      using namespace audioelement;
+      switch(osc) {
+        case OscillatorType::Saw:
+          return voiceStats<Env, OscillatorType::Saw, HarmonicsArray>(harmonics, p, stats);
+        case OscillatorType::Square:
+          return voiceStats<Env, OscillatorType::Square, HarmonicsArray>(harmonics, p, stats);
+        case OscillatorType::Triangle:
+          return voiceStats<Env, OscillatorType::Triangle, HarmonicsArray>(harmonics, p, stats);
+        case OscillatorType::Sinus:
+          return voiceStats<Env, OscillatorType::Sinus, HarmonicsArray>(harmonics, p, stats);
+        case OscillatorType::SinusVolumeAdjusted:
+          return voiceStats<Env, OscillatorType::SinusVolumeAdjusted, HarmonicsArray>(harmonics, p, stats);
+        default:
+          Assert(0);
+          return false;
+      }
+    }
 
     using VoiceWindImpl = Voice<Ctxt::policy, Ctxt::nAudioOut, audio::SoundEngineMode::WIND, true>;
 
-    VoiceWindImpl & windVoice();
+    /*
+    * A wind voice, and the XFade channels it plays on.
+    */
+    struct WindVoice {
+      WindVoice() : voice(buffers) {}
+
+      static constexpr auto n_mnc = VoiceWindImpl::n_channels;
+      using mnc_buffer = VoiceWindImpl::MonoNoteChannel::buffer_t;
+      std::array<mnc_buffer, n_mnc> buffers;
+
+      VoiceWindImpl voice;
+      XFadeChans * chans = nullptr;
+      // count of notes started and not yet stopped on this voice.
+      int nNotes = 0;
+    };
+
+    /*
+    * A pool of wind voices, so that concurrent wind effects don't compete for a single voice.
+    *
+    * A note is played by the voice that already plays a note of the same pitch, if any,
+    * else by the least busy voice.
+    */
+    struct WindVoices {
+      // Must be called prior to initializing the audio context.
+      bool initialize(int nVoices);
+      void finalize();
+
+      onEventResult noteOn(int program, int16_t pitch, float velocity);
+      onEventResult noteOff(int16_t pitch);
+
+      // the cpu cycles attributed to the wind voices, see 'CostGroup'.
+      uint64_t countEstimatedCycles();
+
+    private:
+      // protects 'voices', 'notes' and 'costGroup'
+      std::mutex m;
+      std::vector<std::unique_ptr<WindVoice>> voices;
+
+      struct Note {
+        int16_t pitch;
+        int voice;
+      };
+      // the notes started and not yet stopped, in the order in which they were started.
+      std::vector<Note> notes;
+
+      // see 'CostGroup'
+      int costGroup = -1;
+
+      int findNote(int16_t pitch) const;
+    };
+
+    /*
+    * For cpu accounting, a wind voice is considered as costly as a synth voice
+    * with this count of harmonics.
+    */
+    static constexpr int wind_voice_cost = 8;
+    // the estimated duration of the release of a wind note, in samples.
+    static constexpr int wind_release_samples = SAMPLE_RATE / 2;
+
+    /*
+    * Retrieves the cpu cycles spent computing the audio (measured), and how they are attributed
+    * to the post-processing and to the wind voices (estimated).
+    */
+    void getEngineCycles(uint64_t & total, uint64_t & estimatedPost, uint64_t & estimatedWind);
+
+    WindVoices & windVoices();
+
+    /*
+    * The count of wind voices that will be created at the next initialization.
+    */
+    std::atomic<int> & countWindVoices();
+
+
+    /*
+    * An instrument description, registered once so that notes can be sent using
+    * a handle instead of the full description, see 'noteOnNonBlocking_'.
+    */
+    struct RegisteredInstrument {
+      enum class Kind {
+        Synth,
+        Wind
+      } kind;
+
+      // when kind == Synth
+      audioelement::OscillatorType osc;
+      audioelement::EnvelopeRelease release;
+      AHDSR envelope;
+      VoiceEnvelopeHint hint;
+      std::vector<harmonicProperties_t> harmonics;
+
+      // when kind == Wind
+      int program;
+
+      bool operator == (RegisteredInstrument const & o) const;
+    };
+
+    static constexpr int max_registered_instruments = 1024;
+
+    /*
+    * Returns the handle of the instrument, or -1 if 'max_registered_instruments'
+    * different instruments have already been registered.
+    *
+    * Registering the same instrument twice returns the same handle.
+    */
+    int registerInstrument(RegisteredInstrument i);
+
+    /*
+    * Returns nullptr if the handle is invalid.
+    *
+    * Never locks, and is safe to call concurrently with 'registerInstrument'.
+    */
+    RegisteredInstrument const * registeredInstrument(int handle);
+
+    /*
+    * A note on / note off, sent to a registered instrument.
+    */
+    struct NoteEvent {
+      int32_t instrument;
+      bool noteOn;
+      int16_t pitch;
+      float velocity;
+      int32_t midiSource; // -1 encodes "no source"
+      uint64_t midiTime;
+    };
+
+    using NoteEventsQueue = lockfree::BoundedQueue<NoteEvent, 4096>;
+
+    /*
+    * Note events enqueued by 'noteOnNonBlocking_' and 'noteOffNonBlocking_',
+    * and played by a dedicated thread.
+    */
+    NoteEventsQueue & noteEventsQueue();
+
+    // in sync with the corresponding Haskell Enum instance
+    enum class NonBlockingResult {
+      Enqueued,
+      WouldBlock,
+      InvalidInstrument,
+      NotInitialized,
+      InvalidMidiSource
+    };
 
   } // NS audio
 } // NS imajuscule
@@ -0,0 +1,433 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <random>
+
+#include "cpp.algorithms/include/public.h"
+#include "fft.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#  define IMJ_SIMD_FFT_X86 1
+#  include <immintrin.h>
+#endif
+
+#ifdef __cplusplus
+
+namespace imajuscule::simdfft {
+
+  namespace {
+
+    /*
+    * The inputs of a butterfly are at indices q + s*(p + k*m), the outputs are at indices
+    * q + s*(4*p + k), for 0 <= k < 4.
+    */
+    struct Stage {
+      int m, s;
+      float const * w; // see 'RealFFT::twiddles'
+    };
+
+    void radix4Scalar(Stage const & st, int p, int qBegin,
+                      float const * xr, float const * xi, float * yr, float * yi) {
+      int const m = st.m, s = st.s;
+      float const w1r = st.w[p], w2r = st.w[m + p], w3r = st.w[2*m + p];
+      float const w1i = st.w[3*m + p], w2i = st.w[4*m + p], w3i = st.w[5*m + p];
+      for(int q = qBegin; q < s; ++q) {
+        float const ar = xr[q + s*p],       ai = xi[q + s*p];
+        float const br = xr[q + s*(p+m)],   bi = xi[q + s*(p+m)];
+        float const cr = xr[q + s*(p+2*m)], ci = xi[q + s*(p+2*m)];
+        float const dr = xr[q + s*(p+3*m)], di = xi[q + s*(p+3*m)];
+        float const apcr = ar + cr, apci = ai + ci;
+        float const amcr = ar - cr, amci = ai - ci;
+        float const bpdr = br + dr, bpdi = bi + di;
+        // -i * (b - d)
+        float const jr = bi - di, ji = dr - br;
+        float const y1r = amcr + jr, y1i = amci + ji;
+        float const y2r = apcr - bpdr, y2i = apci - bpdi;
+        float const y3r = amcr - jr, y3i = amci - ji;
+        yr[q + s*4*p] = apcr + bpdr;
+        yi[q + s*4*p] = apci + bpdi;
+        yr[q + s*(4*p+1)] = y1r*w1r - y1i*w1i;
+        yi[q + s*(4*p+1)] = y1r*w1i + y1i*w1r;
+        yr[q + s*(4*p+2)] = y2r*w2r - y2i*w2i;
+        yi[q + s*(4*p+2)] = y2r*w2i + y2i*w2r;
+        yr[q + s*(4*p+3)] = y3r*w3r - y3i*w3i;
+        yi[q + s*(4*p+3)] = y3r*w3i + y3i*w3r;
+      }
+    }
+
+#ifdef IMJ_SIMD_FFT_X86
+
+    /*
+    * The radix-4 butterflies, on vectors of 4 or 8 lanes.
+    */
+    template<typename Ops>
+    struct Butterfly {
+      using V = typename Ops::V;
+
+      V y0r, y0i, y1r, y1i, y2r, y2i, y3r, y3i;
+
+      Butterfly(V ar, V ai, V br, V bi, V cr, V ci, V dr, V di,
+                V w1r, V w1i, V w2r, V w2i, V w3r, V w3i) {
+        V const apcr = Ops::add(ar, cr), apci = Ops::add(ai, ci);
+        V const amcr = Ops::sub(ar, cr), amci = Ops::sub(ai, ci);
+        V const bpdr = Ops::add(br, dr), bpdi = Ops::add(bi, di);
+        V const jr = Ops::sub(bi, di), ji = Ops::sub(dr, br);
+        V const t1r = Ops::add(amcr, jr), t1i = Ops::add(amci, ji);
+        V const t2r = Ops::sub(apcr, bpdr), t2i = Ops::sub(apci, bpdi);
+        V const t3r = Ops::sub(amcr, jr), t3i = Ops::sub(amci, ji);
+        y0r = Ops::add(apcr, bpdr);
+        y0i = Ops::add(apci, bpdi);
+        y1r = Ops::sub(Ops::mul(t1r, w1r), Ops::mul(t1i, w1i));
+        y1i = Ops::add(Ops::mul(t1r, w1i), Ops::mul(t1i, w1r));
+        y2r = Ops::sub(Ops::mul(t2r, w2r), Ops::mul(t2i, w2i));
+        y2i = Ops::add(Ops::mul(t2r, w2i), Ops::mul(t2i, w2r));
+        y3r = Ops::sub(Ops::mul(t3r, w3r), Ops::mul(t3i, w3i));
+        y3i = Ops::add(Ops::mul(t3r, w3i), Ops::mul(t3i, w3r));
+      }
+    };
+
+    struct SSE {
+      using V = __m128;
+
+      static __m128 load(float const * p) { return _mm_loadu_ps(p); }
+      static void store(float * p, __m128 v) { _mm_storeu_ps(p, v); }
+      static __m128 set1(float f) { return _mm_set1_ps(f); }
+      static __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+      static __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+      static __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+    };
+
+    /*
+    * Vectorized over q, for s >= 4.
+    */
+    void radix4SSE(Stage const & st, float const * xr, float const * xi, float * yr, float * yi) {
+      using B = Butterfly<SSE>;
+      int const m = st.m, s = st.s;
+      for(int p=0; p<m; ++p) {
+        __m128 const w1r = SSE::set1(st.w[p]), w2r = SSE::set1(st.w[m + p]), w3r = SSE::set1(st.w[2*m + p]);
+        __m128 const w1i = SSE::set1(st.w[3*m + p]), w2i = SSE::set1(st.w[4*m + p]), w3i = SSE::set1(st.w[5*m + p]);
+        for(int q=0; q<s; q+=4) {
+          B b(SSE::load(xr + q + s*p),       SSE::load(xi + q + s*p),
+              SSE::load(xr + q + s*(p+m)),   SSE::load(xi + q + s*(p+m)),
+              SSE::load(xr + q + s*(p+2*m)), SSE::load(xi + q + s*(p+2*m)),
+              SSE::load(xr + q + s*(p+3*m)), SSE::load(xi + q + s*(p+3*m)),
+              w1r, w1i, w2r, w2i, w3r, w3i);
+          SSE::store(yr + q + s*4*p, b.y0r);     SSE::store(yi + q + s*4*p, b.y0i);
+          SSE::store(yr + q + s*(4*p+1), b.y1r); SSE::store(yi + q + s*(4*p+1), b.y1i);
+          SSE::store(yr + q + s*(4*p+2), b.y2r); SSE::store(yi + q + s*(4*p+2), b.y2i);
+          SSE::store(yr + q + s*(4*p+3), b.y3r); SSE::store(yi + q + s*(4*p+3), b.y3i);
+        }
+      }
+    }
+
+    /*
+    * For s == 1 and m >= 4: vectorized over p, the outputs of 4 consecutive butterflies
+    * are transposed to be stored contiguously.
+    */
+    void radix4FirstStageSSE(Stage const & st, float const * xr, float const * xi, float * yr, float * yi) {
+      using B = Butterfly<SSE>;
+      int const m = st.m;
+      for(int p=0; p<m; p+=4) {
+        B b(SSE::load(xr + p),       SSE::load(xi + p),
+            SSE::load(xr + p + m),   SSE::load(xi + p + m),
+            SSE::load(xr + p + 2*m), SSE::load(xi + p + 2*m),
+            SSE::load(xr + p + 3*m), SSE::load(xi + p + 3*m),
+            SSE::load(st.w + p),       SSE::load(st.w + 3*m + p),
+            SSE::load(st.w + m + p),   SSE::load(st.w + 4*m + p),
+            SSE::load(st.w + 2*m + p), SSE::load(st.w + 5*m + p));
+        _MM_TRANSPOSE4_PS(b.y0r, b.y1r, b.y2r, b.y3r);
+        _MM_TRANSPOSE4_PS(b.y0i, b.y1i, b.y2i, b.y3i);
+        SSE::store(yr + 4*p,      b.y0r); SSE::store(yi + 4*p,      b.y0i);
+        SSE::store(yr + 4*p + 4,  b.y1r); SSE::store(yi + 4*p + 4,  b.y1i);
+        SSE::store(yr + 4*p + 8,  b.y2r); SSE::store(yi + 4*p + 8,  b.y2i);
+        SSE::store(yr + 4*p + 12, b.y3r); SSE::store(yi + 4*p + 12, b.y3i);
+      }
+    }
+
+    struct AVX {
+      __attribute__((target("avx2"))) static __m256 load(float const * p) { return _mm256_loadu_ps(p); }
+      __attribute__((target("avx2"))) static void store(float * p, __m256 v) { _mm256_storeu_ps(p, v); }
+      __attribute__((target("avx2"))) static __m256 set1(float f) { return _mm256_set1_ps(f); }
+      __attribute__((target("avx2"))) static __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+      __attribute__((target("avx2"))) static __m256 sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+      __attribute__((target("avx2"))) static __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+    };
+
+    /*
+    * Vectorized over q, for s >= 8.
+    */
+    __attribute__((target("avx2")))
+    void radix4AVX(Stage const & st, float const * xr, float const * xi, float * yr, float * yi) {
+      int const m = st.m, s = st.s;
+      for(int p=0; p<m; ++p) {
+        __m256 const w1r = AVX::set1(st.w[p]), w2r = AVX::set1(st.w[m + p]), w3r = AVX::set1(st.w[2*m + p]);
+        __m256 const w1i = AVX::set1(st.w[3*m + p]), w2i = AVX::set1(st.w[4*m + p]), w3i = AVX::set1(st.w[5*m + p]);
+        for(int q=0; q<s; q+=8) {
+          // the butterfly is not shared with SSE, so that it is compiled for avx2.
+          __m256 const ar = AVX::load(xr + q + s*p),       ai = AVX::load(xi + q + s*p);
+          __m256 const br = AVX::load(xr + q + s*(p+m)),   bi = AVX::load(xi + q + s*(p+m));
+          __m256 const cr = AVX::load(xr + q + s*(p+2*m)), ci = AVX::load(xi + q + s*(p+2*m));
+          __m256 const dr = AVX::load(xr + q + s*(p+3*m)), di = AVX::load(xi + q + s*(p+3*m));
+          __m256 const apcr = AVX::add(ar, cr), apci = AVX::add(ai, ci);
+          __m256 const amcr = AVX::sub(ar, cr), amci = AVX::sub(ai, ci);
+          __m256 const bpdr = AVX::add(br, dr), bpdi = AVX::add(bi, di);
+          __m256 const jr = AVX::sub(bi, di), ji = AVX::sub(dr, br);
+          __m256 const t1r = AVX::add(amcr, jr), t1i = AVX::add(amci, ji);
+          __m256 const t2r = AVX::sub(apcr, bpdr), t2i = AVX::sub(apci, bpdi);
+          __m256 const t3r = AVX::sub(amcr, jr), t3i = AVX::sub(amci, ji);
+          AVX::store(yr + q + s*4*p, AVX::add(apcr, bpdr));
+          AVX::store(yi + q + s*4*p, AVX::add(apci, bpdi));
+          AVX::store(yr + q + s*(4*p+1), AVX::sub(AVX::mul(t1r, w1r), AVX::mul(t1i, w1i)));
+          AVX::store(yi + q + s*(4*p+1), AVX::add(AVX::mul(t1r, w1i), AVX::mul(t1i, w1r)));
+          AVX::store(yr + q + s*(4*p+2), AVX::sub(AVX::mul(t2r, w2r), AVX::mul(t2i, w2i)));
+          AVX::store(yi + q + s*(4*p+2), AVX::add(AVX::mul(t2r, w2i), AVX::mul(t2i, w2r)));
+          AVX::store(yr + q + s*(4*p+3), AVX::sub(AVX::mul(t3r, w3r), AVX::mul(t3i, w3i)));
+          AVX::store(yi + q + s*(4*p+3), AVX::add(AVX::mul(t3r, w3i), AVX::mul(t3i, w3r)));
+        }
+      }
+    }
+
+    bool detectAVX2() {
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+    }
+
+#endif // IMJ_SIMD_FFT_X86
+
+    void radix4(Stage const & st, float const * xr, float const * xi, float * yr, float * yi) {
+#ifdef IMJ_SIMD_FFT_X86
+      if(st.s >= 8 && instructionSet() == InstructionSet::AVX2) {
+        radix4AVX(st, xr, xi, yr, yi);
+        return;
+      }
+      if(st.s >= 4) {
+        radix4SSE(st, xr, xi, yr, yi);
+        return;
+      }
+      if(st.s == 1 && st.m >= 4) {
+        radix4FirstStageSSE(st, xr, xi, yr, yi);
+        return;
+      }
+#endif
+      for(int p=0; p<st.m; ++p) {
+        radix4Scalar(st, p, 0, xr, xi, yr, yi);
+      }
+    }
+
+    // the last stage, when the size of the complex FFT is not a power of 4.
+    void radix2(int s, float const * xr, float const * xi, float * yr, float * yi) {
+      for(int q=0; q<s; ++q) {
+        float const ar = xr[q], ai = xi[q];
+        float const br = xr[q + s], bi = xi[q + s];
+        yr[q] = ar + br;
+        yi[q] = ai + bi;
+        yr[q + s] = ar - br;
+        yi[q + s] = ai - bi;
+      }
+    }
+
+    template<typename T>
+    void naiveFFT(std::complex<T> * x, int n, int stride, std::complex<T> * out) {
+      if(n == 1) {
+        out[0] = x[0];
+        return;
+      }
+      int const half = n/2;
+      naiveFFT(x, half, 2*stride, out);
+      naiveFFT(x + stride, half, 2*stride, out + half);
+      for(int k=0; k<half; ++k) {
+        auto const t = std::polar(T(1), static_cast<T>(-2 * M_PI * k / n)) * out[k + half];
+        auto const e = out[k];
+        out[k] = e + t;
+        out[k + half] = e - t;
+      }
+    }
+  } // NS
+
+  InstructionSet instructionSet() {
+#ifdef IMJ_SIMD_FFT_X86
+    static InstructionSet const s = detectAVX2() ? InstructionSet::AVX2 : InstructionSet::SSE2;
+    return s;
+#else
+    return InstructionSet::Scalar;
+#endif
+  }
+
+  RealFFT::RealFFT(int n)
+  : n(n)
+  , h(n/2)
+  , rotationRe(n/2)
+  , rotationIm(n/2)
+  , zr(n/2), zi(n/2), wr(n/2), wi(n/2)
+  {
+    Assert(n >= 4 && (n & (n-1)) == 0);
+    for(int s=h; s>=4; s/=4) {
+      int const m = s/4;
+      stageOffsets.push_back(twiddles.size());
+      twiddles.resize(twiddles.size() + 6*m);
+      float * w = twiddles.data() + stageOffsets.back();
+      for(int p=0; p<m; ++p) {
+        for(int k=1; k<=3; ++k) {
+          double const angle = -2. * M_PI * k * p / s;
+          w[(k-1)*m + p] = static_cast<float>(std::cos(angle));
+          w[(k+2)*m + p] = static_cast<float>(std::sin(angle));
+        }
+      }
+    }
+    for(int k=0; k<h; ++k) {
+      double const angle = -2. * M_PI * k / n;
+      rotationRe[k] = static_cast<float>(std::cos(angle));
+      rotationIm[k] = static_cast<float>(std::sin(angle));
+    }
+  }
+
+  void RealFFT::complexForward(float * re, float * im, float * workRe, float * workIm) {
+    float * xr = re, * xi = im, * yr = workRe, * yi = workIm;
+    int s = 1;
+    int size = h;
+    for(int stage = 0; size >= 4; ++stage, size /= 4, s *= 4) {
+      radix4({size/4, s, twiddles.data() + stageOffsets[stage]}, xr, xi, yr, yi);
+      std::swap(xr, yr);
+      std::swap(xi, yi);
+    }
+    if(size == 2) {
+      radix2(s, xr, xi, yr, yi);
+      std::swap(xr, yr);
+      std::swap(xi, yi);
+    }
+    if(xr != re) {
+      std::copy(xr, xr + h, re);
+      std::copy(xi, xi + h, im);
+    }
+  }
+
+  void RealFFT::forward(float const * x, float * re, float * im) {
+    // z[k] = x[2k] + i x[2k+1]
+    for(int k=0; k<h; ++k) {
+      zr[k] = x[2*k];
+      zi[k] = x[2*k+1];
+    }
+    complexForward(zr.data(), zi.data(), wr.data(), wi.data());
+
+    // separates the spectrums of even and odd samples, then combines them.
+    re[0] = zr[0] + zi[0];
+    im[0] = zr[0] - zi[0];
+    for(int k=1; k<h; ++k) {
+      // a = z[k], b = conj(z[h-k])
+      float const ar = zr[k], ai = zi[k];
+      float const br = zr[h-k], bi = -zi[h-k];
+      // even = (a + b) / 2, odd = -i (a - b) / 2
+      float const er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+      float const or_ = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+      re[k] = er + rotationRe[k] * or_ - rotationIm[k] * oi;
+      im[k] = ei + rotationRe[k] * oi + rotationIm[k] * or_;
+    }
+  }
+
+  void RealFFT::inverse(float const * re, float const * im, float * x) {
+    zr[0] = re[0] + im[0];
+    zi[0] = re[0] - im[0];
+    for(int k=1; k<h; ++k) {
+      // a = X[k], b = conj(X[h-k])
+      float const ar = re[k], ai = im[k];
+      float const br = re[h-k], bi = -im[h-k];
+      float const er = ar + br, ei = ai + bi;
+      // odd = (a - b) * conj(rotation[k])
+      float const dr = ar - br, di = ai - bi;
+      float const or_ = dr * rotationRe[k] + di * rotationIm[k];
+      float const oi = di * rotationRe[k] - dr * rotationIm[k];
+      // z = even + i odd
+      zr[k] = er - oi;
+      zi[k] = ei + or_;
+    }
+    // the inverse FFT is the forward FFT with real and imaginary parts swapped.
+    complexForward(zi.data(), zr.data(), wi.data(), wr.data());
+    for(int k=0; k<h; ++k) {
+      x[2*k] = zr[k];
+      x[2*k+1] = zi[k];
+    }
+  }
+
+  template<typename T>
+  void naiveRealFFT(float const * x, int n, T * re, T * im) {
+    std::vector<std::complex<T>> in(x, x + n), out(n);
+    naiveFFT(in.data(), n, 1, out.data());
+    re[0] = out[0].real();
+    im[0] = out[n/2].real();
+    for(int k=1; k<n/2; ++k) {
+      re[k] = out[k].real();
+      im[k] = out[k].imag();
+    }
+  }
+
+  template void naiveRealFFT<float>(float const * x, int n, float * re, float * im);
+  template void naiveRealFFT<double>(float const * x, int n, double * re, double * im);
+
+  namespace {
+    std::vector<float> randomSignal(int n) {
+      std::mt19937 gen(n);
+      std::uniform_real_distribution<float> dist(-1.f, 1.f);
+      std::vector<float> x(n);
+      for(auto & v : x) {
+        v = dist(gen);
+      }
+      return x;
+    }
+  }
+
+  double maxRelativeError(int n) {
+    auto const x = randomSignal(n);
+    std::vector<double> refRe(n/2), refIm(n/2);
+    naiveRealFFT(x.data(), n, refRe.data(), refIm.data());
+    std::vector<float> re(n/2), im(n/2);
+    RealFFT fft(n);
+    fft.forward(x.data(), re.data(), im.data());
+
+    double maxMagnitude = 0., maxError = 0.;
+    for(int k=0; k<n/2; ++k) {
+      maxMagnitude = std::max({maxMagnitude, std::abs(refRe[k]), std::abs(refIm[k])});
+      maxError = std::max({maxError, std::abs(refRe[k] - re[k]), std::abs(refIm[k] - im[k])});
+    }
+
+    // the inverse transform should give back the signal, scaled by n.
+    std::vector<float> y(n);
+    fft.inverse(re.data(), im.data(), y.data());
+    for(int k=0; k<n; ++k) {
+      maxError = std::max(maxError, std::abs(y[k] / n - x[k]) * maxMagnitude);
+    }
+    return maxMagnitude ? (maxError / maxMagnitude) : maxError;
+  }
+
+  Benchmark benchmark(int n, int nIterations) {
+    using Clock = std::chrono::steady_clock;
+    auto const x = randomSignal(n);
+    std::vector<float> re(n/2), im(n/2);
+    nIterations = std::max(1, nIterations);
+
+    auto measure = [nIterations](auto f) {
+      f(); // warm-up
+      auto const start = Clock::now();
+      for(int i=0; i<nIterations; ++i) {
+        f();
+      }
+      return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / nIterations;
+    };
+
+    // the naive FFT of cpp.algorithms, used by the audio engine when the 'SlowFFT' flag is set.
+    using SlowTag = fft::imj::Tag;
+    fft::ScopedContext_<SlowTag, float> slowContext(n);
+    fft::Algo_<SlowTag, float> slowFFT(slowContext.get());
+    auto const slowSignal = fft::RealSignal_<SlowTag, float>::make(x);
+    typename fft::RealFBins_<SlowTag, float>::type slowBins(n);
+
+    RealFFT fft(n);
+    Benchmark b;
+    b.slowNanos = measure([&]() { slowFFT.forward(slowSignal.begin(), slowBins, n); });
+    b.simdNanos = measure([&]() { fft.forward(x.data(), re.data(), im.data()); });
+    return b;
+  }
+
+} // NS imajuscule::simdfft
+
+#endif
@@ -0,0 +1,96 @@
+/*
+  A real FFT using SIMD instructions, needing no external library:
+  SSE2 is used on x86, and AVX2 is used when the cpu supports it (this is detected at runtime).
+
+  The complex FFT used internally is a radix-4 Stockham autosort FFT (hence there is no
+  bit-reversal pass), operating on split real / imaginary arrays, with twiddles
+  precomputed for every stage.
+*/
+
+#ifdef __cplusplus
+
+#include <vector>
+
+namespace imajuscule::simdfft {
+
+  // in sync with the corresponding Haskell Enum instance
+  enum class InstructionSet {
+    Scalar,
+    SSE2,
+    AVX2
+  };
+
+  /*
+  * The instruction set used by 'RealFFT', detected once at runtime.
+  */
+  InstructionSet instructionSet();
+
+  /*
+  * Forward and inverse FFTs of real signals of a fixed size, which must be a power of 2, >= 4.
+  *
+  * The spectrum is in the "packed split" format:
+  * - for 0 < k < n/2, (re[k], im[k]) is the k-th bin,
+  * - re[0] is the (real) DC bin, and im[0] is the (real) Nyquist bin.
+  *
+  * The transforms are not normalized: inverse(forward(x)) == n * x.
+  *
+  * An instance is not thread-safe, because it uses internal buffers.
+  */
+  struct RealFFT {
+    explicit RealFFT(int n);
+
+    int size() const { return n; }
+
+    void forward(float const * x, float * re, float * im);
+    void inverse(float const * re, float const * im, float * x);
+
+  private:
+    int n;
+    // the size of the complex FFT
+    int h;
+
+    // for every radix-4 stage of size s, at offset 'stageOffsets[stage]':
+    //   the real parts, then the imaginary parts of w^p, w^2p, w^3p
+    //   for 0 <= p < s/4, where w = exp(-2 i pi / s)
+    std::vector<float> twiddles;
+    std::vector<int> stageOffsets;
+    // exp(-2 i pi k / n) for 0 <= k < h
+    std::vector<float> rotationRe, rotationIm;
+
+    // buffers of the complex FFT
+    std::vector<float> zr, zi, wr, wi;
+
+    // the result is written in (re, im)
+    void complexForward(float * re, float * im, float * workRe, float * workIm);
+  };
+
+  /*
+  * A naive real FFT, computed with a recursive radix-2 complex FFT of size n,
+  * used as a reference to verify 'RealFFT'.
+  *
+  * The spectrum has the same format as for 'RealFFT'.
+  */
+  template<typename T>
+  void naiveRealFFT(float const * x, int n, T * re, T * im);
+
+  /*
+  * Returns the maximum absolute difference between the spectrums computed by 'RealFFT'
+  * and by the (double precision) naive FFT, for a random signal of size n, relatively to
+  * the maximum magnitude of the spectrum.
+  */
+  double maxRelativeError(int n);
+
+  struct Benchmark {
+    // average durations of a forward transform
+    double slowNanos, simdNanos;
+  };
+
+  /*
+  * Compares 'RealFFT' with the naive FFT of cpp.algorithms (the one used by the audio engine
+  * when the 'SlowFFT' flag is set).
+  */
+  Benchmark benchmark(int n, int nIterations);
+
+} // NS imajuscule::simdfft
+
+#endif
@@ -0,0 +1,197 @@
+/*
+  The cpu governor watches the duration of audio callbacks, relatively to the duration
+  of the audio they compute (the "load" of the audio callback).
+
+  When the load is too high, audio glitches are imminent, so the governor
+  progressively degrades the audio quality, by:
+  - not playing the high harmonics of new notes,
+  - limiting the count of voices per instrument.
+  When the load is low again, the governor progressively restores the audio quality.
+
+  A quality level change only updates values read when notes start, so it is cheap.
+  The reverb is not degraded: the engine can change the subsampling of the reverb
+  response tail only by reloading the response, which is costly and drops the reverb tail.
+*/
+
+#ifdef __cplusplus
+
+namespace imajuscule::audio {
+
+  /*
+  * Written by the audio realtime thread, read by the cpu governor.
+  *
+  * A load of 1 means that the audio callback took as long as the duration
+  * of the audio it computed.
+  */
+  struct CallbackLoad {
+    // exponentially weighted moving average of the load
+    std::atomic<float> average{0.f};
+    // maximum load since the last call to 'takePeak'
+    std::atomic<float> peak{0.f};
+    // count of audio callbacks whose load was above 1
+    std::atomic<uint64_t> nOverruns{0};
+
+    float takePeak() {
+      return peak.exchange(0.f, std::memory_order_relaxed);
+    }
+  };
+
+  CallbackLoad & callbackLoad();
+
+  /*
+  * Owned by the audio realtime thread.
+  */
+  struct CallbackLoadMeter {
+    using Clock = std::chrono::steady_clock;
+
+    // the weight of the last callback in the moving average
+    static constexpr float smoothing = 0.05f;
+
+    /*
+    * @param f : the audio callback, computing 'nFrames' frames.
+    */
+    template<typename F>
+    void step(int nFrames, F && f) {
+      auto const start = Clock::now();
+      f();
+      auto const end = Clock::now();
+      if(nFrames <= 0) {
+        return;
+      }
+      auto & s = callbackLoad();
+      float const load = std::chrono::duration<float>(end - start).count() * SAMPLE_RATE / nFrames;
+      average += smoothing * (load - average);
+      s.average.store(average, std::memory_order_relaxed);
+      if(load > 1.f) {
+        s.nOverruns.fetch_add(1, std::memory_order_relaxed);
+      }
+      auto peak = s.peak.load(std::memory_order_relaxed);
+      while(load > peak && !s.peak.compare_exchange_weak(peak, load, std::memory_order_relaxed)) {
+      }
+    }
+
+  private:
+    float average = 0.f;
+  };
+
+  /*
+  * The quality level 0 is the best quality, the last quality level is the lowest quality.
+  */
+  struct QualityLevel {
+    // see 'countPlayedHarmonics'
+    int harmonicsLevel;
+    // the maximum count of voices per instrument, 0 means no limit.
+    int maxVoices;
+  };
+
+  static constexpr std::array<QualityLevel, 6> quality_levels{{
+    {0, 0},
+    {1, 0},
+    {2, 0},
+    {2, 8},
+    {3, 8},
+    {3, 4}
+  }};
+
+  struct HarmonicsLimit {
+    int maxCount;
+    // relatively to the volume of the loudest harmonic
+    float minVolume;
+  };
+
+  // indexed by 'QualityLevel::harmonicsLevel'
+  static constexpr std::array<HarmonicsLimit, 4> harmonics_limits{{
+    {std::numeric_limits<int>::max(), 0.f},
+    {16, 1e-3f}, // -60 dB
+    {8, 1e-2f},  // -40 dB
+    {4, 3e-2f}   // -30 dB
+  }};
+
+  /*
+  * Returns the count of harmonics that should be played, for a given harmonics level:
+  * trailing harmonics whose volume is small relatively to the loudest harmonic
+  * are not played, and the count of harmonics is limited.
+  */
+  int countPlayedHarmonics(harmonicProperties_t const * hars, int n, int harmonicsLevel);
+
+  // the governor considers the load of the audio callback to be too high above these values
+  static constexpr float high_average_load = 0.75f;
+  static constexpr float high_peak_load = 0.9f;
+  // the governor considers the load of the audio callback to be low below these values
+  static constexpr float low_average_load = 0.4f;
+  static constexpr float low_peak_load = 0.6f;
+
+  struct GovernorAdjustment {
+    // since the initialization of the audio output
+    uint64_t nanos;
+    int fromLevel, toLevel;
+    // the load that triggered the adjustment
+    float averageLoad, peakLoad;
+  };
+
+  /*
+  * Runs in its own thread while the audio output is initialized,
+  * the thread checks the load only while the governor is enabled.
+  */
+  struct CpuGovernor {
+    using Clock = std::chrono::steady_clock;
+
+    // how often the load is checked
+    static constexpr auto period = std::chrono::milliseconds(100);
+    // the minimum duration between two quality degradations, to let the new level take effect
+    static constexpr auto min_degradation_interval = std::chrono::milliseconds(500);
+    // the duration of low load after which the quality is improved by one level
+    static constexpr auto restore_after = std::chrono::seconds(3);
+
+    // in sync with 'maxCpuGovernorAdjustments' in the Haskell code
+    static constexpr int n_max_adjustments = 64;
+
+    void start();
+    void stop();
+
+    /*
+    * When disabled, the governor uses the best quality level,
+    * and its thread sleeps until the governor is enabled.
+    */
+    void enable(bool b);
+
+    int level() const {
+      return currentLevel.load(std::memory_order_relaxed);
+    }
+    QualityLevel const & quality() const {
+      return quality_levels[level()];
+    }
+
+    // the total count of adjustments since the initialization of the audio output
+    uint64_t countAdjustments();
+    /*
+    * Returns false if the adjustment doesn't exist, or is too old
+    * (only the last 'n_max_adjustments' adjustments are kept).
+    */
+    bool getAdjustment(uint64_t index, GovernorAdjustment & a);
+
+  private:
+    std::atomic<bool> enabled{false};
+    std::atomic<int> currentLevel{0};
+
+    std::atomic<bool> running{false};
+    // protects the writes to 'enabled' and 'running', to not miss a wake up
+    std::mutex sleepMutex;
+    std::condition_variable cv;
+    std::thread thread;
+    Clock::time_point startTime;
+
+    // protects the adjustments log
+    std::mutex adjustmentsMutex;
+    std::array<GovernorAdjustment, n_max_adjustments> adjustments;
+    uint64_t nAdjustments = 0;
+
+    void run();
+    void setLevel(int l, float average, float peak);
+  };
+
+  CpuGovernor & cpuGovernor();
+
+} // NS imajuscule::audio
+
+#endif
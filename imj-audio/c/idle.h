@@ -0,0 +1,138 @@
+/*
+  When no note is playing and the reverb tail has decayed, the audio callback
+  doesn't need to compute anything: 'IdleDetector' detects this situation,
+  and then writes zeros to the output buffer instead of computing audio,
+  until a new event is sent to the audio engine.
+
+  While idle, the audio engine is still stepped for 0 frames at every audio callback,
+  so that it keeps receiving the callback time (used to synchronize MIDI timestamped events)
+  and keeps running its bookkeeping (one-shots, queued channel removals): only the synthesis is skipped.
+*/
+
+#ifdef __cplusplus
+
+namespace imajuscule::audio {
+
+  /*
+  * Written by the audio realtime thread, read by 'getIdleStats_'.
+  */
+  struct IdleStats {
+    std::atomic<uint64_t> nActiveCallbacks{0};
+    std::atomic<uint64_t> nIdleCallbacks{0};
+    // count of transitions from active to idle
+    std::atomic<uint64_t> nSleeps{0};
+    // count of transitions from idle to active
+    std::atomic<uint64_t> nWakeUps{0};
+    // cumulated and maximum durations of idle callbacks (writing zeros and stepping the audio engine for 0 frames)
+    std::atomic<uint64_t> idleNanos{0};
+    std::atomic<uint64_t> maxIdleNanos{0};
+    std::atomic<bool> idle{false};
+  };
+
+  IdleStats & idleStats();
+
+  /*
+  * Is incremented every time an event (a note, a change in postprocessing, etc.)
+  * is sent to the audio engine.
+  */
+  std::atomic<uint64_t> & countEngineEvents();
+
+  // Must be called prior to sending an event to the audio engine.
+  inline void onEngineEvent() {
+    countEngineEvents().fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  /*
+  * The output is considered silent when the absolute value of every sample is below this value (-100 dB).
+  */
+  static constexpr double silence_threshold = 1e-5;
+
+  /*
+  * The minimum duration of silence, in seconds, before the audio engine is considered idle.
+  *
+  * It should be long enough so that a note whose start is delayed to avoid MIDI jitter
+  * doesn't start while the engine is idle, and to let the reverb tail decay below
+  * 'silence_threshold'.
+  */
+  static constexpr double min_silence_seconds = 0.5;
+
+  /*
+  * Owned by the audio realtime thread.
+  */
+  template<int nOuts>
+  struct IdleDetector {
+    using Clock = std::chrono::steady_clock;
+
+    /*
+    * @param render : computes 'nFrames' frames in 'buf', using the audio engine.
+    * @param skip : steps the audio engine for 0 frames, called instead of 'render' when idle.
+    */
+    template<typename T, typename Render, typename Skip>
+    void step(T * buf, int nFrames, Render && render, Skip && skip) {
+      auto & stats = idleStats();
+
+      auto const events = countEngineEvents().load(std::memory_order_acquire);
+      if(events != lastEvents) {
+        lastEvents = events;
+        silentFrames = 0;
+        if(idle) {
+          idle = false;
+          stats.idle.store(false, std::memory_order_relaxed);
+          stats.nWakeUps.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+      if(idle) {
+        auto const start = Clock::now();
+        std::fill(buf, buf + nFrames * nOuts, T{});
+        skip();
+        auto const nanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        stats.nIdleCallbacks.fetch_add(1, std::memory_order_relaxed);
+        stats.idleNanos.fetch_add(nanos, std::memory_order_relaxed);
+        if(nanos > stats.maxIdleNanos.load(std::memory_order_relaxed)) {
+          // we are the only writer
+          stats.maxIdleNanos.store(nanos, std::memory_order_relaxed);
+        }
+        return;
+      }
+
+      render(buf, nFrames);
+      stats.nActiveCallbacks.fetch_add(1, std::memory_order_relaxed);
+
+      if(!isSilent(buf, nFrames * nOuts)) {
+        silentFrames = 0;
+        return;
+      }
+      silentFrames += nFrames;
+      if(silentFrames >= minSilentFrames()) {
+        idle = true;
+        stats.idle.store(true, std::memory_order_relaxed);
+        stats.nSleeps.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    bool idle = false;
+    uint64_t lastEvents = 0;
+    int64_t silentFrames = 0;
+
+    template<typename T>
+    static bool isSilent(T const * buf, int n) {
+      for(int i=0; i<n; ++i) {
+        if(std::abs(buf[i]) >= silence_threshold) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    static int64_t minSilentFrames() {
+      // 'maxMIDIJitter' is in nanoseconds.
+      return static_cast<int64_t>(min_silence_seconds * SAMPLE_RATE) +
+        static_cast<int64_t>(maxMIDIJitter() * SAMPLE_RATE / 1000000000);
+    }
+  };
+
+} // NS imajuscule::audio
+
+#endif
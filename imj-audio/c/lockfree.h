@@ -0,0 +1,159 @@
+/*
+  Lock-free datastructures used by this C++ layer.
+*/
+
+#ifdef __cplusplus
+
+namespace imajuscule::lockfree {
+
+  /*
+  * A bounded multi-producer, multi-consumer queue
+  * (see http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue).
+  *
+  * 'tryPush' and 'tryPop' never lock, never allocate and never wait:
+  * they give up and return false when the queue is full (resp. empty),
+  * or when they failed to win a race against other producers (resp. consumers)
+  * after a few attempts.
+  */
+  template<typename T, int N>
+  struct BoundedQueue {
+    static_assert(N >= 2 && (N & (N-1)) == 0, "N must be a power of 2");
+
+    BoundedQueue() {
+      for(int i=0; i<N; ++i) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    bool tryPush(T const & v) {
+      auto pos = enqueuePos.load(std::memory_order_relaxed);
+      for(int attempt = 0; attempt < max_attempts; ++attempt) {
+        auto & cell = cells[pos & mask];
+        auto const seq = cell.sequence.load(std::memory_order_acquire);
+        auto const dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if(dif == 0) {
+          if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.value = v;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+          // 'pos' was updated by compare_exchange_weak
+        }
+        else if(dif < 0) {
+          // full
+          return false;
+        }
+        else {
+          pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+      }
+      return false;
+    }
+
+    bool tryPop(T & v) {
+      auto pos = dequeuePos.load(std::memory_order_relaxed);
+      for(int attempt = 0; attempt < max_attempts; ++attempt) {
+        auto & cell = cells[pos & mask];
+        auto const seq = cell.sequence.load(std::memory_order_acquire);
+        auto const dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if(dif == 0) {
+          if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            v = cell.value;
+            cell.sequence.store(pos + mask + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if(dif < 0) {
+          // empty
+          return false;
+        }
+        else {
+          pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+      }
+      return false;
+    }
+
+    /*
+    * Returns true if no element is ready to be popped.
+    */
+    bool empty() const {
+      auto const pos = dequeuePos.load(std::memory_order_relaxed);
+      return cells[pos & mask].sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+  private:
+    static constexpr size_t mask = N - 1;
+    static constexpr int max_attempts = 16;
+
+    struct Cell {
+      std::atomic<size_t> sequence;
+      T value;
+    };
+
+    // on different cache lines, to avoid false sharing between producers and consumers.
+    alignas(64) std::array<Cell, N> cells;
+    alignas(64) std::atomic<size_t> enqueuePos{0};
+    alignas(64) std::atomic<size_t> dequeuePos{0};
+  };
+
+  /*
+  * A bounded single-producer, single-consumer ring buffer.
+  *
+  * The producer functions ('countFree', 'write') and the consumer functions
+  * ('countAvailable', 'read', 'discard') never lock, never allocate and never wait.
+  */
+  template<typename T, int N>
+  struct SpscRing {
+    static_assert(N >= 2 && (N & (N-1)) == 0, "N must be a power of 2");
+
+    int countFree() const {
+      return N - static_cast<int>(writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire));
+    }
+
+    /*
+    * Writes 'n' elements, 'n' must be less than or equal to 'countFree()'.
+    */
+    template<typename U>
+    void write(U const * src, int n) {
+      auto const pos = writePos.load(std::memory_order_relaxed);
+      auto const start = static_cast<int>(pos & mask);
+      auto const n1 = std::min(n, N - start);
+      std::copy(src, src + n1, buf.begin() + start);
+      std::copy(src + n1, src + n, buf.begin());
+      writePos.store(pos + n, std::memory_order_release);
+    }
+
+    int countAvailable() const {
+      return static_cast<int>(writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed));
+    }
+
+    /*
+    * Reads 'n' elements, 'n' must be less than or equal to 'countAvailable()'.
+    */
+    void read(T * dst, int n) {
+      auto const pos = readPos.load(std::memory_order_relaxed);
+      auto const start = static_cast<int>(pos & mask);
+      auto const n1 = std::min(n, N - start);
+      std::copy(buf.begin() + start, buf.begin() + start + n1, dst);
+      std::copy(buf.begin(), buf.begin() + (n - n1), dst + n1);
+      readPos.store(pos + n, std::memory_order_release);
+    }
+
+    // Drops all available elements.
+    void discard() {
+      readPos.store(writePos.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+  private:
+    static constexpr size_t mask = N - 1;
+
+    std::array<T, N> buf;
+    // on different cache lines, to avoid false sharing between the producer and the consumer.
+    alignas(64) std::atomic<size_t> writePos{0};
+    alignas(64) std::atomic<size_t> readPos{0};
+  };
+
+} // NS imajuscule::lockfree
+
+#endif
@@ -0,0 +1,144 @@
+/*
+  Metering of the final output of the audio engine (after the post-processing):
+  for every audio callback, the peak, the RMS and the count of clipped samples
+  of every channel are computed, using SSE2 when available.
+*/
+
+#ifdef __cplusplus
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+namespace imajuscule::audio {
+
+  // samples whose absolute value is above this value are clipped by the audio device.
+  static constexpr float clip_threshold = 1.f;
+
+  struct BlockLevels {
+    float peak = 0.f;
+    float sumSquares = 0.f;
+    int nClips = 0;
+  };
+
+  /*
+  * Measures the levels of the samples of one channel, with a stride of 'nOuts'.
+  */
+  template<int nOuts, typename T>
+  void measureLevelsScalar(T const * buf, int nFrames, BlockLevels & l) {
+    for(int i=0; i<nFrames; ++i) {
+      float const v = static_cast<float>(buf[i*nOuts]);
+      float const a = std::abs(v);
+      l.peak = std::max(l.peak, a);
+      l.sumSquares += v * v;
+      if(a > clip_threshold) {
+        ++l.nClips;
+      }
+    }
+  }
+
+  /*
+  * Measures the levels of every channel of an interleaved buffer.
+  */
+  template<int nOuts, typename T>
+  void measureLevels(T const * buf, int nFrames, std::array<BlockLevels, nOuts> & levels) {
+    for(auto & l : levels) {
+      l = {};
+    }
+    int nDone = 0;
+#if defined(__SSE2__)
+    if constexpr (std::is_same_v<T, float> && (4 % nOuts == 0)) {
+      // lane i of a vector holds a sample of channel i % nOuts.
+      int const nVectors = (nFrames * nOuts) / 4;
+      __m128 const absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+      __m128 const threshold = _mm_set1_ps(clip_threshold);
+      // two sets of accumulators, to shorten the dependency chains
+      __m128 peak[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+      __m128 sumSquares[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+      // the comparison masks are -1 when true, so they are subtracted.
+      __m128i clips[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+      auto const accumulate = [&](int acc, __m128 const v) {
+        __m128 const a = _mm_and_ps(v, absMask);
+        peak[acc] = _mm_max_ps(peak[acc], a);
+        sumSquares[acc] = _mm_add_ps(sumSquares[acc], _mm_mul_ps(v, v));
+        clips[acc] = _mm_sub_epi32(clips[acc], _mm_castps_si128(_mm_cmpgt_ps(a, threshold)));
+      };
+      int i=0;
+      for(; i+1<nVectors; i+=2) {
+        accumulate(0, _mm_loadu_ps(buf + 4*i));
+        accumulate(1, _mm_loadu_ps(buf + 4*i + 4));
+      }
+      if(i<nVectors) {
+        accumulate(0, _mm_loadu_ps(buf + 4*i));
+      }
+      alignas(16) float peaks[4], sums[4];
+      alignas(16) int32_t nClips[4];
+      _mm_store_ps(peaks, _mm_max_ps(peak[0], peak[1]));
+      _mm_store_ps(sums, _mm_add_ps(sumSquares[0], sumSquares[1]));
+      _mm_store_si128(reinterpret_cast<__m128i*>(nClips), _mm_add_epi32(clips[0], clips[1]));
+      for(int lane=0; lane<4; ++lane) {
+        auto & l = levels[lane % nOuts];
+        l.peak = std::max(l.peak, peaks[lane]);
+        l.sumSquares += sums[lane];
+        l.nClips += nClips[lane];
+      }
+      nDone = (nVectors * 4) / nOuts;
+    }
+#endif
+    for(int c=0; c<nOuts; ++c) {
+      measureLevelsScalar<nOuts>(buf + nDone * nOuts + c, nFrames - nDone, levels[c]);
+    }
+  }
+
+  /*
+  * Written by the audio realtime thread, read by 'getOutputLevels_'.
+  */
+  struct ChannelLevels {
+    // the peak and RMS of the last audio callback
+    std::atomic<float> peak{0.f};
+    std::atomic<float> rms{0.f};
+    // maximum peak since the last call to 'takeMaxPeak'
+    std::atomic<float> maxPeak{0.f};
+    // count of samples above 'clip_threshold'
+    std::atomic<uint64_t> nClips{0};
+
+    float takeMaxPeak() {
+      return maxPeak.exchange(0.f, std::memory_order_relaxed);
+    }
+  };
+
+  template<int nOuts>
+  using OutputLevels = std::array<ChannelLevels, nOuts>;
+
+  /*
+  * Owned by the audio realtime thread.
+  */
+  template<int nOuts>
+  struct LevelMeter {
+    template<typename T>
+    void step(T const * buf, int nFrames, OutputLevels<nOuts> & out) {
+      if(nFrames <= 0) {
+        return;
+      }
+      measureLevels<nOuts>(buf, nFrames, levels);
+      for(int c=0; c<nOuts; ++c) {
+        auto const & l = levels[c];
+        auto & o = out[c];
+        o.peak.store(l.peak, std::memory_order_relaxed);
+        o.rms.store(std::sqrt(l.sumSquares / nFrames), std::memory_order_relaxed);
+        if(l.nClips) {
+          o.nClips.fetch_add(l.nClips, std::memory_order_relaxed);
+        }
+        auto maxPeak = o.maxPeak.load(std::memory_order_relaxed);
+        while(l.peak > maxPeak && !o.maxPeak.compare_exchange_weak(maxPeak, l.peak, std::memory_order_relaxed)) {
+        }
+      }
+    }
+
+  private:
+    std::array<BlockLevels, nOuts> levels;
+  };
+
+} // NS imajuscule::audio
+
+#endif
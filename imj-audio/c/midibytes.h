@@ -0,0 +1,173 @@
+/*
+  Parsing of raw MIDI 1.0 byte streams.
+
+  Only note on / note off messages produce events, the other messages are skipped.
+  Running status is supported, and a message can be split across several buffers
+  because the parser state is kept per MIDI source.
+*/
+
+#ifdef __cplusplus
+
+namespace imajuscule::audio {
+
+  // the count of MIDI sources that can be encoded by the audio engine
+  static constexpr int n_midi_sources = 16384;
+  static constexpr int n_midi_channels = 16;
+  static constexpr int n_midi_pitches = 128;
+
+  struct MidiNoteMessage {
+    uint8_t channel;
+    bool noteOn;
+    uint8_t pitch;
+    // 0..127, a note on with a velocity of 0 is a note off.
+    uint8_t velocity;
+  };
+
+  /*
+  * The parser state of a MIDI source.
+  */
+  struct MidiParser {
+    /*
+    * @param f : called for every note on / note off message.
+    */
+    template<typename F>
+    void feed(uint8_t const * bytes, int n, F && f) {
+      for(int i=0; i<n; ++i) {
+        uint8_t const b = bytes[i];
+        if(b >= 0xF8) {
+          // System Real-Time messages can be interleaved with any other message,
+          // and don't affect the running status.
+          continue;
+        }
+        if(b & 0x80) {
+          nData = 0;
+          if(b >= 0xF0) {
+            // System Common messages and System Exclusive cancel the running status,
+            // their data bytes are skipped.
+            runningStatus = 0;
+          } else {
+            runningStatus = b;
+          }
+          continue;
+        }
+        if(!runningStatus) {
+          continue;
+        }
+        data[nData++] = b;
+        if(nData < countDataBytes(runningStatus)) {
+          continue;
+        }
+        nData = 0;
+        switch(runningStatus & 0xF0) {
+          case 0x80:
+            f(MidiNoteMessage{static_cast<uint8_t>(runningStatus & 0x0F), false, data[0], data[1]});
+            break;
+          case 0x90:
+            f(MidiNoteMessage{static_cast<uint8_t>(runningStatus & 0x0F), data[1] != 0, data[0], data[1]});
+            break;
+          default:
+            break;
+        }
+      }
+    }
+
+  private:
+    // 0 when there is no running status
+    uint8_t runningStatus = 0;
+    uint8_t nData = 0;
+    std::array<uint8_t, 2> data;
+
+    static int countDataBytes(uint8_t status) {
+      switch(status & 0xF0) {
+        case 0xC0: // Program Change
+        case 0xD0: // Channel Pressure
+          return 1;
+        default:
+          return 2;
+      }
+    }
+  };
+
+  /*
+  * Maps MIDI sources to their parser state, and MIDI channels to registered instruments.
+  *
+  * Also remembers which instrument played the held notes, so that a note off is played
+  * by the instrument that played the note on, even if the instrument of the channel
+  * changed in-between.
+  */
+  struct MidiInput {
+    MidiInput() {
+      for(auto & i : channelInstruments) {
+        i.store(-1, std::memory_order_relaxed);
+      }
+      for(auto & i : heldInstruments) {
+        i.store(-1, std::memory_order_relaxed);
+      }
+    }
+
+    /*
+    * The bytes of a given source must be parsed by a single thread at a time.
+    */
+    MidiParser & parser(int source) {
+      return parsers[source];
+    }
+
+    /*
+    * @param instrument : a registered instrument handle, or -1 to ignore the notes of the channel.
+    */
+    void setChannelInstrument(int channel, int instrument) {
+      channelInstruments[channel].store(instrument, std::memory_order_relaxed);
+    }
+
+    int channelInstrument(int channel) const {
+      return channelInstruments[channel].load(std::memory_order_relaxed);
+    }
+
+    /*
+    * Calls 'play(instrument, noteOn)' for the note events of a message:
+    *
+    * - A note on is played by the instrument of its channel. If the same channel and pitch
+    *   is held by another instrument, that note is stopped first.
+    * - A note off is played by the instrument that played the note on of the same
+    *   channel and pitch, and is ignored if there is no such note.
+    *
+    * 'play' returns false when the note event was dropped.
+    *
+    * Held notes are tracked per channel and pitch, regardless of the MIDI source.
+    */
+    template<typename F>
+    void route(MidiNoteMessage const & m, F && play) {
+      auto & held = heldInstruments[m.channel * n_midi_pitches + m.pitch];
+      if(!m.noteOn) {
+        int const instrument = held.exchange(-1, std::memory_order_relaxed);
+        if(instrument >= 0) {
+          play(instrument, false);
+        }
+        return;
+      }
+      int const instrument = channelInstrument(m.channel);
+      if(instrument < 0) {
+        return;
+      }
+      int const previous = held.load(std::memory_order_relaxed);
+      if(previous >= 0 && previous != instrument) {
+        held.store(-1, std::memory_order_relaxed);
+        play(previous, false);
+      }
+      if(play(instrument, true)) {
+        held.store(instrument, std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    std::array<MidiParser, n_midi_sources> parsers;
+    std::array<std::atomic<int>, n_midi_channels> channelInstruments;
+    // indexed by channel * n_midi_pitches + pitch, -1 when the note is not held.
+    std::array<std::atomic<int>, n_midi_channels * n_midi_pitches> heldInstruments;
+  };
+
+  MidiInput & midiInput();
+
+} // NS imajuscule::audio
+
+#endif
@@ -0,0 +1,107 @@
+/*
+  A counting semaphore, used to wake up a sleeping thread without taking a lock:
+
+  'post' never locks and never allocates. It makes a system call only
+  when a thread is waiting on the semaphore.
+*/
+
+#ifdef __cplusplus
+
+#if defined(_WIN32)
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#elif defined(__APPLE__)
+#  include <dispatch/dispatch.h>
+#else
+#  include <cerrno>
+#  include <ctime>
+#  include <semaphore.h>
+#endif
+
+namespace imajuscule::lockfree {
+
+  struct Semaphore {
+    Semaphore() {
+#if defined(_WIN32)
+      s = CreateSemaphore(nullptr, 0, LONG_MAX, nullptr);
+#elif defined(__APPLE__)
+      s = dispatch_semaphore_create(0);
+#else
+      sem_init(&s, 0, 0);
+#endif
+    }
+
+    ~Semaphore() {
+#if defined(_WIN32)
+      CloseHandle(s);
+#elif defined(__APPLE__)
+      dispatch_release(s);
+#else
+      sem_destroy(&s);
+#endif
+    }
+
+    Semaphore(Semaphore const &) = delete;
+    Semaphore & operator=(Semaphore const &) = delete;
+
+    void post() {
+#if defined(_WIN32)
+      ReleaseSemaphore(s, 1, nullptr);
+#elif defined(__APPLE__)
+      dispatch_semaphore_signal(s);
+#else
+      sem_post(&s);
+#endif
+    }
+
+    void wait() {
+#if defined(_WIN32)
+      WaitForSingleObject(s, INFINITE);
+#elif defined(__APPLE__)
+      dispatch_semaphore_wait(s, DISPATCH_TIME_FOREVER);
+#else
+      while(sem_wait(&s) == -1 && errno == EINTR) {
+      }
+#endif
+    }
+
+    /*
+    * Like 'wait', but returns after at most 'd' (with the precision of the system timers).
+    */
+    template<typename Duration>
+    void waitFor(Duration d) {
+      auto const nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+#if defined(_WIN32)
+      WaitForSingleObject(s, static_cast<DWORD>((nanos + 999999) / 1000000));
+#elif defined(__APPLE__)
+      dispatch_semaphore_wait(s, dispatch_time(DISPATCH_TIME_NOW, nanos));
+#else
+      // 'sem_timedwait' takes an absolute time, measured with the realtime clock.
+      timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      auto const sum = static_cast<int64_t>(ts.tv_nsec) + nanos;
+      ts.tv_sec += static_cast<time_t>(sum / 1000000000);
+      ts.tv_nsec = static_cast<long>(sum % 1000000000);
+      while(sem_timedwait(&s, &ts) == -1 && errno == EINTR) {
+      }
+#endif
+    }
+
+  private:
+#if defined(_WIN32)
+    HANDLE s;
+#elif defined(__APPLE__)
+    dispatch_semaphore_t s;
+#else
+    sem_t s;
+#endif
+  };
+
+} // NS imajuscule::lockfree
+
+#endif
@@ -1,6 +1,7 @@
 #include "compiler.prepro.h"
 #include "extras.h"
 #include "memory.h"
+#include "fft.h"
 
 #ifdef __cplusplus
 
@@ -64,24 +65,210 @@ namespace imajuscule::audioelement {
     }
   }
 
-  audio::onEventResult midiEventAHDSR(OscillatorType osc, EnvelopeRelease t,
-                                      CConstArray<harmonicProperties_t> const & harmonics,
-                                      AHDSR p, audio::Event n, Optional<audio::MIDITimestampAndSource> maybeMts) {
+  template<template<Atomicity, typename, EnvelopeRelease> typename Envelope>
+  audio::onEventResult midiEventAHDSR_(OscillatorType osc, EnvelopeRelease t,
+                                       audio::InstrumentHarmonics<CConstArray<harmonicProperties_t>> const & harmonics,
+                                       AHDSR p, audio::Event n, audio::MaybeMIDITime const & midi,
+                                       audio::VoiceEnvelopeHint const & hint) {
     using namespace audio;
     static constexpr auto A = getAtomicity<audio::Ctxt::policy>();
     switch(t) {
       case EnvelopeRelease::ReleaseAfterDecay:
-        return midiEvent_<AHDSREnvelope<A, AudioFloat, EnvelopeRelease::ReleaseAfterDecay>>(osc, harmonics, p, n, maybeMts);
+        return midiEvent_<Envelope<A, AudioFloat, EnvelopeRelease::ReleaseAfterDecay>>(osc, harmonics, p, n, midi, hint);
       case EnvelopeRelease::WaitForKeyRelease:
-        return midiEvent_<AHDSREnvelope<A, AudioFloat, EnvelopeRelease::WaitForKeyRelease>>(osc, harmonics, p, n, maybeMts);
+        return midiEvent_<Envelope<A, AudioFloat, EnvelopeRelease::WaitForKeyRelease>>(osc, harmonics, p, n, midi, hint);
       default:
       Assert(0);
       return onEventResult::DROPPED_NOTE;
     }
   }
 
+  audio::onEventResult midiEventAHDSR(OscillatorType osc, EnvelopeRelease t,
+                                      harmonicProperties_t const * hars, int har_sz,
+                                      AHDSR p, audio::Event n, audio::MaybeMIDITime const & midi,
+                                      audio::VoiceEnvelopeHint const & hint) {
+    using namespace audio;
+    int const level = cpuGovernor().quality().harmonicsLevel;
+    CConstArray<harmonicProperties_t> const all{hars, har_sz};
+    int const nPlayed = countPlayedHarmonics(hars, har_sz, level);
+    CConstArray<harmonicProperties_t> const played{hars, nPlayed};
+    InstrumentHarmonics<CConstArray<harmonicProperties_t>> const harmonics{all, played, nPlayed, level};
+    if(tabulatedEnvelopes()) {
+      return midiEventAHDSR_<TabulatedAHDSREnvelope>(osc, t, harmonics, p, n, midi, hint);
+    }
+    return midiEventAHDSR_<AHDSREnvelope>(osc, t, harmonics, p, n, midi, hint);
+  }
+
+  template<template<Atomicity, typename, EnvelopeRelease> typename Envelope>
+  bool voiceStatsAHDSR_(OscillatorType osc, EnvelopeRelease t,
+                        CConstArray<harmonicProperties_t> const & harmonics,
+                        AHDSR p, audio::VoiceStats & stats) {
+    using namespace audio;
+    static constexpr auto A = getAtomicity<audio::Ctxt::policy>();
+    switch(t) {
+      case EnvelopeRelease::ReleaseAfterDecay:
+        return voiceStats_<Envelope<A, AudioFloat, EnvelopeRelease::ReleaseAfterDecay>>(osc, harmonics, p, stats);
+      case EnvelopeRelease::WaitForKeyRelease:
+        return voiceStats_<Envelope<A, AudioFloat, EnvelopeRelease::WaitForKeyRelease>>(osc, harmonics, p, stats);
+      default:
+      Assert(0);
+      return false;
+    }
+  }
+
+  bool voiceStatsAHDSR(OscillatorType osc, EnvelopeRelease t,
+                       CConstArray<harmonicProperties_t> const & harmonics,
+                       AHDSR p, audio::VoiceStats & stats) {
+    if(audio::tabulatedEnvelopes()) {
+      return voiceStatsAHDSR_<TabulatedAHDSREnvelope>(osc, t, harmonics, p, stats);
+    }
+    return voiceStatsAHDSR_<AHDSREnvelope>(osc, t, harmonics, p, stats);
+  }
+
+  double tabulatedEnvelopeError(EnvelopeRelease t, AHDSR p) {
+    static constexpr auto A = getAtomicity<audio::Ctxt::policy>();
+    switch(t) {
+      case EnvelopeRelease::ReleaseAfterDecay:
+        return tabulatedEnvelopeMaxError<A, AudioFloat, EnvelopeRelease::ReleaseAfterDecay>(p);
+      case EnvelopeRelease::WaitForKeyRelease:
+        return tabulatedEnvelopeMaxError<A, AudioFloat, EnvelopeRelease::WaitForKeyRelease>(p);
+      default:
+        Assert(0);
+        return -1.;
+    }
+  }
+
 } // NS imajuscule::audioelement
 
+namespace imajuscule::audio {
+
+  onEventResult playNoteEvent(NoteEvent const & e) {
+    using namespace audioelement;
+    auto const * i = registeredInstrument(e.instrument);
+    if(unlikely(!i)) {
+      return onEventResult::DROPPED_NOTE;
+    }
+    if(i->kind == RegisteredInstrument::Kind::Wind) {
+      return e.noteOn ?
+        windVoices().noteOn(i->program, e.pitch, e.velocity) :
+        windVoices().noteOff(e.pitch);
+    }
+    auto n = e.noteOn ? mkNoteOn(e.pitch, e.velocity) : mkNoteOff(e.pitch);
+    return midiEventAHDSR(i->osc, i->release, i->harmonics.data(), static_cast<int>(i->harmonics.size()),
+                          i->envelope, n, MaybeMIDITime{e.midiSource, e.midiTime}, i->hint);
+  }
+
+  /*
+  * Plays the note events of 'noteEventsQueue()', so that the (possibly blocking)
+  * work of sending a note to the audio engine is not done by the thread calling
+  * 'noteOnNonBlocking_' / 'noteOffNonBlocking_'.
+  *
+  * Also retries the note ons of 'deferredNoteOns()'.
+  */
+  struct NoteEventsWorker {
+    bool isRunning() const {
+      return running.load(std::memory_order_acquire);
+    }
+
+    void start() {
+      Assert(!thread.joinable());
+      running = true;
+      thread = std::thread([this]() { run(); });
+    }
+
+    void stop() {
+      if(!thread.joinable()) {
+        return;
+      }
+      running = false;
+      sem.post();
+      thread.join();
+      // drop the events that were not played
+      NoteEvent e;
+      while(noteEventsQueue().tryPop(e)) {
+      }
+      deferredNoteOns().clear();
+    }
+
+    /*
+    * Must be called after an event was pushed to 'noteEventsQueue()'.
+    *
+    * Never locks: when the worker is not sleeping, this only reads an atomic.
+    * When the worker is sleeping, this posts to 'sem', which makes a system call.
+    */
+    void wakeUp() {
+      // Pairs with the fence in 'run': either the worker sees the pushed event
+      // before going to sleep, or we see that the worker is sleeping.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(sleeping.exchange(false)) {
+        // if the worker has not started waiting yet, the post is not lost:
+        // its wait will return immediately.
+        sem.post();
+      }
+    }
+
+  private:
+    // how often deferred note ons are retried
+    static constexpr auto retry_period = std::chrono::milliseconds(1);
+
+    std::atomic<bool> running{false};
+    std::atomic<bool> sleeping{false};
+    lockfree::Semaphore sem;
+    std::thread thread;
+
+    void run() {
+      NoteEvent e;
+      while(true) {
+        while(noteEventsQueue().tryPop(e)) {
+          if(playNoteEvent(e) != onEventResult::OK) {
+            LG(WARN, "a non-blocking note event was dropped");
+          }
+        }
+        bool const deferred = deferredNoteOns().retry();
+        if(!running) {
+          return;
+        }
+        sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // an event pushed after the queue was drained, but before 'sleeping' was set, is seen here.
+        // 'stop' posts after resetting 'running', so its post is not lost either.
+        if(noteEventsQueue().empty() && running) {
+          if(deferred) {
+            sem.waitFor(retry_period);
+          }
+          else {
+            sem.wait();
+          }
+        }
+        sleeping.store(false);
+      }
+    }
+  };
+
+  NoteEventsWorker & noteEventsWorker() {
+    static NoteEventsWorker w;
+    return w;
+  }
+
+  void wakeUpNoteEventsWorker() {
+    noteEventsWorker().wakeUp();
+  }
+
+  NonBlockingResult enqueueNoteEvent(NoteEvent const & e) {
+    if(unlikely(!noteEventsWorker().isRunning())) {
+      return NonBlockingResult::NotInitialized;
+    }
+    if(unlikely(!registeredInstrument(e.instrument))) {
+      return NonBlockingResult::InvalidInstrument;
+    }
+    if(!noteEventsQueue().tryPush(e)) {
+      return NonBlockingResult::WouldBlock;
+    }
+    noteEventsWorker().wakeUp();
+    return NonBlockingResult::Enqueued;
+  }
+
+} // NS imajuscule::audio
 
 
 extern "C" {
@@ -146,26 +333,22 @@ extern "C" {
 
     disableDenormals();
 
-    //testFreeList();
+    tabulatedEnvelopes() = requestTabulatedEnvelopes().load();
 
-    // add a single Xfade channel (for 'SoundEngine' and 'Channel' that don't support envelopes entirely)
-    static constexpr auto n_max_orchestrator_per_channel = 1;
-    auto [xfadeChan, _] = getAudioContext().getChannelHandler().getChannels().getChannelsXFade().emplace_front(
-      getAudioContext().getChannelHandler().get_lock_policy(),
-      std::numeric_limits<uint8_t>::max(),
-      n_max_orchestrator_per_channel);
+    //testFreeList();
 
-    windVoice().initializeSlow();
-    if(!windVoice().initialize(xfadeChan)) {
-      LG(ERR,"windVoice().initialize failed");
+    if(!windVoices().initialize(std::max(1, countWindVoices().load()))) {
+      LG(ERR,"windVoices().initialize failed");
       return false;
     }
-    getXfadeChannels() = &xfadeChan;
 
     if(!getAudioContext().Init(minLatencySeconds)) {
       return false;
     }
 
+    noteEventsWorker().start();
+    cpuGovernor().start();
+
     {
       auto & d = midiDelays(); // to allocate the static inside
       if(d.empty()) {
@@ -204,13 +387,23 @@ extern "C" {
       return;
     }
 
+    // No more non-blocking note events will be played.
+    noteEventsWorker().stop();
+    cpuGovernor().stop();
+
     if(getAudioContext().Initialized()) {
       // This will "quickly" crossfade the audio output channels to zero.
+      onEngineEvent();
       getAudioContext().onApplicationShouldClose();
 
       // we sleep whil channels are crossfaded to zero
 
+      // the audio engine computes blocks of 'audio_block_frames' frames, but
+      // the latency depends on the count of frames requested by the audio callback.
       int bufferSize = n_audio_cb_frames.load(std::memory_order_relaxed);
+      if(bufferSize != initial_n_audio_cb_frames) {
+        bufferSize = std::max(bufferSize, n_device_cb_frames().load(std::memory_order_relaxed));
+      }
       if(bufferSize == initial_n_audio_cb_frames) {
         // assume a very big buffer size if the audio callback didn't have a chance
         // to run yet.
@@ -225,7 +418,10 @@ extern "C" {
 
     // All channels have crossfaded to 0 by now.
 
-    windVoice().finalize();
+    // the recording includes the crossfade
+    wavWriter().stop();
+
+    windVoices().finalize();
 
     foreachOscillatorType<FinalizeSynths>();
 
@@ -253,10 +449,8 @@ extern "C" {
     }
     auto p = AHDSR{a,itp::toItp(ai),h,d,itp::toItp(di),r,itp::toItp(ri),s};
     auto n = mkNoteOn(pitch,velocity);
-    auto maybeMts = (midiSource >= 0) ?
-      Optional<MIDITimestampAndSource>{{maybeMIDITime, static_cast<uint64_t>(midiSource)}} :
-      Optional<MIDITimestampAndSource>{};
-    return convert(midiEventAHDSR(osc, t, {hars, har_sz}, p, n, maybeMts));
+    auto hint = VoiceEnvelopeHint{a,h,d,r,s,t == EnvelopeRelease::ReleaseAfterDecay};
+    return convert(midiEventAHDSR(osc, t, hars, har_sz, p, n, MaybeMIDITime{midiSource, maybeMIDITime}, hint));
   }
   bool midiNoteOffAHDSR_(imajuscule::audioelement::OscillatorType osc,
                          imajuscule::audioelement::EnvelopeRelease t,
@@ -271,10 +465,118 @@ extern "C" {
     }
     auto p = AHDSR{a,itp::toItp(ai),h,d,itp::toItp(di),r,itp::toItp(ri),s};
     auto n = mkNoteOff(pitch);
-    auto maybeMts = (midiSource >= 0) ?
-      Optional<MIDITimestampAndSource>{{maybeMIDITime, static_cast<uint64_t>(midiSource)}} :
-      Optional<MIDITimestampAndSource>{};
-    return convert(midiEventAHDSR(osc, t, {hars, har_sz}, p, n, maybeMts));
+    auto hint = VoiceEnvelopeHint{a,h,d,r,s,t == EnvelopeRelease::ReleaseAfterDecay};
+    return convert(midiEventAHDSR(osc, t, hars, har_sz, p, n, MaybeMIDITime{midiSource, maybeMIDITime}, hint));
+  }
+
+  /*
+  * Sets the policy used when an instrument has no free channel to play a new note.
+  *
+  * @param policy : see 'VoiceStealing'.
+  */
+  void setVoiceStealing(int policy) {
+    using namespace imajuscule::audio;
+    voiceStealing() = static_cast<VoiceStealing>(policy);
+  }
+
+  /*
+  * Limits the count of voices that a single instrument can hold simultaneously,
+  * to bound the cpu usage. Pass 0 to remove the limit.
+  */
+  void setMaxVoicesPerInstrument(int n) {
+    using namespace imajuscule::audio;
+    maxVoicesPerInstrument() = std::max(0, n);
+  }
+
+  /*
+  * Returns the index of the voice that 'policy' steals to play a new note of pitch 'pitch'
+  * starting at 'nowFrame', or -1 if no voice is stolen.
+  *
+  * The voices use the same envelope, voice i has pitch 'pitches[i]', velocity 'velocities[i]',
+  * and starts at 'startFrames[i]'. They must be ordered by start time.
+  * Times are MIDI times, in frames.
+  *
+  * The instrument can hold at most 'maxVoices' voices.
+  */
+  int analyzeVoiceStealing_(int policy, imajuscule::audioelement::EnvelopeRelease t,
+                            int a, int h, int d, float s, int r,
+                            int nVoices, int16_t const * pitches, float const * velocities, int const * startFrames,
+                            int maxVoices, int16_t pitch, int nowFrame) {
+    using namespace imajuscule::audio;
+    using namespace imajuscule::audioelement;
+    static constexpr int max_voices = 64;
+    if(nVoices < 0 || nVoices > max_voices) {
+      return -1;
+    }
+    auto const hint = VoiceEnvelopeHint{a,h,d,r,s,t == EnvelopeRelease::ReleaseAfterDecay};
+    auto const at = [](int frame) {
+      return NoteTime{{}, MaybeMIDITime{0, framesToNanos(frame)}};
+    };
+    HeldVoices<max_voices> voices;
+    for(int i=0; i<nVoices; ++i) {
+      voices.add(pitches[i], velocities[i], hint, at(startFrames[i]));
+    }
+    return voices.pickVictim(static_cast<VoiceStealing>(policy), pitch, at(nowFrame), nVoices >= maxVoices);
+  }
+
+  /*
+  * Retrieves the count of held voices, stolen voices and dropped notes of an instrument,
+  * and the cpu cycles attributed to the instrument: they are estimated, not measured (see 'CostGroup').
+  *
+  * @returns false if the instrument doesn't exist.
+  */
+  bool getVoiceStatsAHDSR_(imajuscule::audioelement::OscillatorType osc,
+                           imajuscule::audioelement::EnvelopeRelease t,
+                           int a, int ai, int h, int d, int di, float s, int r, int ri,
+                           harmonicProperties_t * hars, int har_sz,
+                           int * nHeld, int * nSteals, int * nDrops, uint64_t * estimatedCycles) {
+    using namespace imajuscule;
+    using namespace imajuscule::audio;
+    using namespace imajuscule::audioelement;
+    auto p = AHDSR{a,itp::toItp(ai),h,d,itp::toItp(di),r,itp::toItp(ri),s};
+    VoiceStats stats;
+    if(!voiceStatsAHDSR(osc, t, {hars, har_sz}, p, stats)) {
+      return false;
+    }
+    *nHeld = stats.nHeld;
+    *nSteals = stats.nSteals;
+    *nDrops = stats.nDrops;
+    *estimatedCycles = stats.estimatedCycles;
+    return true;
+  }
+
+  /*
+  * Same as 'getVoiceStatsAHDSR_', for an instrument registered with 'registerInstrumentAHDSR_'.
+  *
+  * @returns false if the handle is invalid, if the instrument is a wind instrument
+  * (see 'getEngineCycles_') or if the instrument has not played yet.
+  */
+  bool getRegisteredVoiceStats_(int instrument, int * nHeld, int * nSteals, int * nDrops, uint64_t * estimatedCycles) {
+    using namespace imajuscule;
+    using namespace imajuscule::audio;
+    using namespace imajuscule::audioelement;
+    auto const * i = registeredInstrument(instrument);
+    if(!i || i->kind != RegisteredInstrument::Kind::Synth) {
+      return false;
+    }
+    VoiceStats stats;
+    if(!voiceStatsAHDSR(i->osc, i->release, {i->harmonics.data(), static_cast<int>(i->harmonics.size())}, i->envelope, stats)) {
+      return false;
+    }
+    *nHeld = stats.nHeld;
+    *nSteals = stats.nSteals;
+    *nDrops = stats.nDrops;
+    *estimatedCycles = stats.estimatedCycles;
+    return true;
+  }
+
+  /*
+  * Retrieves the cpu cycles spent by the audio engine computing audio (measured), and the
+  * cycles attributed to the post-processing (reverb, mixing) and to the wind voices (estimated).
+  */
+  void getEngineCycles_(uint64_t * total, uint64_t * estimatedPost, uint64_t * estimatedWind) {
+    using namespace imajuscule::audio;
+    getEngineCycles(*total, *estimatedPost, *estimatedWind);
   }
 
   double* analyzeAHDSREnvelope_(imajuscule::audioelement::EnvelopeRelease t, int a, int ai, int h, int d, int di, float s, int r, int ri, int*nElems, int*splitAt) {
@@ -285,13 +587,451 @@ extern "C" {
     return analyzeEnvelopeGraph(t, p, nElems, splitAt);
   }
 
+  /*
+  * Returns the maximum absolute difference between the values of the analytic envelope
+  * and the values of the corresponding tabulated envelope.
+  */
+  double analyzeTabulatedAHDSREnvelopeError_(imajuscule::audioelement::EnvelopeRelease t, int a, int ai, int h, int d, int di, float s, int r, int ri) {
+    using namespace imajuscule;
+    using namespace imajuscule::audioelement;
+    auto p = AHDSR{a,itp::toItp(ai),h,d,itp::toItp(di),r,itp::toItp(ri),s};
+    return tabulatedEnvelopeError(t, p);
+  }
+
+  /*
+  * When true, instruments read their envelope values in tables instead of evaluating
+  * the envelope interpolations for every sample, see 'TabulatedAHDSREnvelope'.
+  *
+  * This is taken into account at the next initialization of the audio output.
+  */
+  void setTabulatedEnvelopes(bool b) {
+    using namespace imajuscule::audio;
+    requestTabulatedEnvelopes() = b;
+  }
+
+  /*
+  * Sets the count of wind voices used to play concurrent wind effects.
+  * The new count is taken into account at the next initialization of the audio output.
+  */
+  void setWindVoicesCount(int n) {
+    using namespace imajuscule::audio;
+    countWindVoices() = std::max(1, n);
+  }
+
+  /*
+  * Registers an instrument, so that its notes can be played with 'noteOnNonBlocking_'
+  * and 'noteOffNonBlocking_'.
+  *
+  * @returns the handle of the instrument, or -1 if too many instruments were registered.
+  */
+  int registerInstrumentAHDSR_(imajuscule::audioelement::OscillatorType osc,
+                               imajuscule::audioelement::EnvelopeRelease t,
+                               int a, int ai, int h, int d, int di, float s, int r, int ri,
+                               harmonicProperties_t * hars, int har_sz) {
+    using namespace imajuscule;
+    using namespace imajuscule::audio;
+    using namespace imajuscule::audioelement;
+    RegisteredInstrument i;
+    i.kind = RegisteredInstrument::Kind::Synth;
+    i.osc = osc;
+    i.release = t;
+    i.envelope = AHDSR{a,itp::toItp(ai),h,d,itp::toItp(di),r,itp::toItp(ri),s};
+    i.hint = VoiceEnvelopeHint{a,h,d,r,s,t == EnvelopeRelease::ReleaseAfterDecay};
+    i.harmonics.assign(hars, hars + std::max(0, har_sz));
+    i.program = 0;
+    return registerInstrument(std::move(i));
+  }
+
+  /*
+  * Registers a wind effect program, see 'registerInstrumentAHDSR_'.
+  */
+  int registerWindInstrument_(int program) {
+    using namespace imajuscule::audio;
+    RegisteredInstrument i;
+    i.kind = RegisteredInstrument::Kind::Wind;
+    i.program = program;
+    return registerInstrument(std::move(i));
+  }
+
+  /*
+  * Plays a note using an instrument registered by 'registerInstrumentAHDSR_' or
+  * 'registerWindInstrument_'.
+  *
+  * This function never allocates and doesn't wait on the audio engine, so it can be imported
+  * as an 'unsafe' haskell function: the note is enqueued in a lock-free queue, and will be played
+  * (shortly after) by a dedicated thread. When that thread is sleeping, it is woken up,
+  * which takes a mutex for a very short time and may make a system call.
+  *
+  * @returns a 'NonBlockingResult'.
+  */
+  int noteOnNonBlocking_(int instrument, int16_t pitch, float velocity, int midiSource, uint64_t maybeMIDITime) {
+    using namespace imajuscule::audio;
+    return static_cast<int>(enqueueNoteEvent({instrument, true, pitch, velocity, midiSource, maybeMIDITime}));
+  }
+
+  /*
+  * See 'noteOnNonBlocking_'.
+  */
+  int noteOffNonBlocking_(int instrument, int16_t pitch, int midiSource, uint64_t maybeMIDITime) {
+    using namespace imajuscule::audio;
+    return static_cast<int>(enqueueNoteEvent({instrument, false, pitch, 0.f, midiSource, maybeMIDITime}));
+  }
+
+  /*
+  * Retrieves the levels of a channel of the audio output, measured after the post-processing (reverb):
+  *
+  * @param peak, rms : the peak and the RMS of the last audio callback.
+  * @param maxPeak : the maximum peak since the previous call to this function for this channel.
+  * @param nClips : the total count of samples whose absolute value was above 1.
+  *
+  * @returns false if the channel is invalid.
+  */
+  bool getOutputLevels_(int channel, float * peak, float * rms, float * maxPeak, uint64_t * nClips) {
+    using namespace imajuscule::audio;
+    if(channel < 0 || channel >= nAudioOuts) {
+      return false;
+    }
+    auto & l = outputLevels()[channel];
+    *peak = l.peak.load(std::memory_order_relaxed);
+    *rms = l.rms.load(std::memory_order_relaxed);
+    *maxPeak = l.takeMaxPeak();
+    *nClips = l.nClips.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  /*
+  * Measures the levels of a pseudo-random interleaved buffer of 'nFrames' frames with 'measureLevels'
+  * (which uses SSE2 when available), and compares them with the levels measured by 'measureLevelsScalar'.
+  * The samples are in [-1.5, 1.5], so that some are clipped.
+  *
+  * @param peakError : the maximum absolute difference of the peaks of a channel.
+  * @param sumSquaresError : the maximum difference of the sums of squares of a channel,
+  *                          relatively to the sum of squares.
+  * @param nClipsErrors : the count of channels whose counts of clipped samples differ.
+  * @returns false if 'nFrames' is negative.
+  */
+  bool analyzeOutputLevels_(int nFrames, float * peakError, float * sumSquaresError, int * nClipsErrors) {
+    using namespace imajuscule::audio;
+    if(nFrames < 0) {
+      return false;
+    }
+    std::vector<float> buf(nFrames * nAudioOuts);
+    uint32_t seed = 12345;
+    for(auto & v : buf) {
+      // linear congruential generator, to be deterministic
+      seed = seed * 1664525u + 1013904223u;
+      v = 3.f * (static_cast<float>(seed >> 8) / static_cast<float>(1 << 24)) - 1.5f;
+    }
+    std::array<BlockLevels, nAudioOuts> levels;
+    measureLevels<nAudioOuts>(buf.data(), nFrames, levels);
+
+    *peakError = 0.f;
+    *sumSquaresError = 0.f;
+    *nClipsErrors = 0;
+    for(int c=0; c<nAudioOuts; ++c) {
+      BlockLevels ref;
+      measureLevelsScalar<nAudioOuts>(buf.data() + c, nFrames, ref);
+      *peakError = std::max(*peakError, std::abs(levels[c].peak - ref.peak));
+      if(ref.sumSquares > 0.f) {
+        *sumSquaresError = std::max(*sumSquaresError, std::abs(levels[c].sumSquares - ref.sumSquares) / ref.sumSquares);
+      }
+      else if(levels[c].sumSquares != 0.f) {
+        *sumSquaresError = std::numeric_limits<float>::infinity();
+      }
+      if(levels[c].nClips != ref.nClips) {
+        ++*nClipsErrors;
+      }
+    }
+    return true;
+  }
+
+  /*
+  * Enables or disables the capture of the audio output, see 'readOutputCapture_'.
+  *
+  * @returns false if the capture could not be enabled because a wav recording is in progress.
+  */
+  bool enableOutputCapture_(bool enable) {
+    using namespace imajuscule::audio;
+    if(enable) {
+      return outputCapture().enable(CaptureReader::User);
+    }
+    outputCapture().disable(CaptureReader::User);
+    return true;
+  }
+
+  int countOutputCaptureChannels_() {
+    using namespace imajuscule::audio;
+    return nAudioOuts;
+  }
+
+  /*
+  * Reads at most 'maxFrames' interleaved frames of the captured audio output.
+  * The frames are captured after the post-processing (reverb).
+  *
+  * @returns the count of frames read, or -1 if the capture was not enabled with
+  * 'enableOutputCapture_', or if another thread is reading the capture.
+  */
+  int readOutputCapture_(float * buf, int maxFrames) {
+    using namespace imajuscule::audio;
+    return outputCapture().read(CaptureReader::User, buf, maxFrames);
+  }
+
+  /*
+  * Retrieves the counts of frames that were dropped because the captured audio output
+  * was not read fast enough.
+  *
+  * @param nOverruns : the count of audio callbacks during which frames were dropped.
+  */
+  void getOutputCaptureOverruns_(uint64_t * nOverruns, uint64_t * nDroppedFrames) {
+    using namespace imajuscule::audio;
+    *nOverruns = outputCapture().nOverruns.load(std::memory_order_relaxed);
+    *nDroppedFrames = outputCapture().nDroppedFrames.load(std::memory_order_relaxed);
+  }
+
+  /*
+  * Enables the capture of the audio output, and streams it to a wav file
+  * (32 bits float samples) from a dedicated thread, until 'stopWavRecording_' is called
+  * or the audio output is torn down.
+  *
+  * @returns false if a recording is already in progress, if the capture was enabled
+  * with 'enableOutputCapture_', or if the file could not be created.
+  */
+  bool startWavRecording_(char const * path) {
+    using namespace imajuscule::audio;
+    return wavWriter().start(path);
+  }
+
+  void stopWavRecording_() {
+    using namespace imajuscule::audio;
+    wavWriter().stop();
+  }
+
+  /*
+  * Assigns a registered instrument to a MIDI channel (0..15), so that the notes
+  * of this channel passed to 'midiBytes_' are played with this instrument.
+  *
+  * @param instrument : a handle returned by 'registerInstrumentAHDSR_' or 'registerWindInstrument_',
+  *                     or -1 to ignore the notes of the channel.
+  * @returns false if the channel or the handle is invalid.
+  */
+  bool setMidiChannelInstrument_(int channel, int instrument) {
+    using namespace imajuscule::audio;
+    if(channel < 0 || channel >= n_midi_channels) {
+      return false;
+    }
+    if(instrument != -1 && !registeredInstrument(instrument)) {
+      return false;
+    }
+    midiInput().setChannelInstrument(channel, instrument);
+    return true;
+  }
+
+  /*
+  * Parses a buffer of raw MIDI 1.0 bytes received from a MIDI source, and plays
+  * the note on messages using the instruments assigned to their channel
+  * (see 'setMidiChannelInstrument_'). A note off is played by the instrument
+  * that played the corresponding note on (see 'MidiInput::route').
+  *
+  * A message can be split across consecutive buffers of the same source, and running status is supported.
+  *
+  * Like 'noteOnNonBlocking_', this function never locks, never allocates, and wakes the thread playing the notes up.
+  * The buffers of a given source must not be passed concurrently.
+  *
+  * @param source : in 0..16383
+  * @returns a 'NonBlockingResult': 'WouldBlock' if at least one note was dropped because the queue was full,
+  *          'InvalidMidiSource' if the source is out of range.
+  */
+  int midiBytes_(int source, uint64_t timestamp, uint8_t const * bytes, int n) {
+    using namespace imajuscule::audio;
+    if(unlikely(!noteEventsWorker().isRunning())) {
+      return static_cast<int>(NonBlockingResult::NotInitialized);
+    }
+    if(unlikely(source < 0 || source >= n_midi_sources)) {
+      return static_cast<int>(NonBlockingResult::InvalidMidiSource);
+    }
+    auto & input = midiInput();
+    auto res = NonBlockingResult::Enqueued;
+    input.parser(source).feed(bytes, n, [&](MidiNoteMessage const & m) {
+      input.route(m, [&](int instrument, bool noteOn) {
+        NoteEvent const e{
+          instrument,
+          noteOn,
+          m.pitch,
+          noteOn ? (m.velocity / 127.f) : 0.f,
+          source,
+          timestamp
+        };
+        if(!noteEventsQueue().tryPush(e)) {
+          res = NonBlockingResult::WouldBlock;
+          return false;
+        }
+        return true;
+      });
+    });
+    noteEventsWorker().wakeUp();
+    return static_cast<int>(res);
+  }
+  /*
+  * Parses 'bytes' with a new MIDI parser, passing them in chunks of 'chunkSize' bytes,
+  * and writes the note on / note off messages to 'messages', using 4 bytes per message:
+  * the channel, 1 for a note on (else 0), the pitch and the velocity.
+  *
+  * @returns the count of messages, or -1 if there are more than 'maxMessages' messages.
+  */
+  int analyzeMidiBytes_(uint8_t const * bytes, int n, int chunkSize, uint8_t * messages, int maxMessages) {
+    using namespace imajuscule::audio;
+    MidiParser parser;
+    int nMessages = 0;
+    chunkSize = std::max(1, chunkSize);
+    for(int i=0; i<n; i += chunkSize) {
+      parser.feed(bytes + i, std::min(chunkSize, n - i), [&](MidiNoteMessage const & m) {
+        if(nMessages++ >= maxMessages) {
+          return;
+        }
+        auto * out = messages + 4 * (nMessages - 1);
+        out[0] = m.channel;
+        out[1] = m.noteOn ? 1 : 0;
+        out[2] = m.pitch;
+        out[3] = m.velocity;
+      });
+    }
+    return (nMessages > maxMessages) ? -1 : nMessages;
+  }
+
+  /*
+  * Routes MIDI note messages to instruments like 'midiBytes_' does, using a new 'MidiInput'.
+  *
+  * @param steps : 'nSteps' steps of 3 ints each: (0, channel, instrument) assigns an instrument
+  *                (an arbitrary number, or -1) to a channel, and (1, byte, 0) passes a byte to the parser.
+  * @param events : the note events, using 3 ints per event: the instrument, 1 for a note on (else 0),
+  *                 and the pitch.
+  * @returns the count of note events, or -1 if there are more than 'maxEvents' events.
+  */
+  int analyzeMidiRouting_(int const * steps, int nSteps, int * events, int maxEvents) {
+    using namespace imajuscule::audio;
+    auto input = std::make_unique<MidiInput>();
+    int nEvents = 0;
+    for(int i=0; i<nSteps; ++i) {
+      int const * step = steps + 3 * i;
+      if(step[0] == 0) {
+        if(step[1] >= 0 && step[1] < n_midi_channels) {
+          input->setChannelInstrument(step[1], step[2]);
+        }
+        continue;
+      }
+      uint8_t const byte = static_cast<uint8_t>(step[1]);
+      input->parser(0).feed(&byte, 1, [&](MidiNoteMessage const & m) {
+        input->route(m, [&](int instrument, bool noteOn) {
+          if(nEvents++ < maxEvents) {
+            auto * out = events + 3 * (nEvents - 1);
+            out[0] = instrument;
+            out[1] = noteOn ? 1 : 0;
+            out[2] = m.pitch;
+          }
+          return true;
+        });
+      });
+    }
+    return (nEvents > maxEvents) ? -1 : nEvents;
+  }
+
+  /*
+  * Pushes 'nPerProducer' elements from each of 'nProducers' threads to a 'BoundedQueue'
+  * of 'analyzed_queue_size' elements, while a consumer thread pops them if 'consume' is true.
+  *
+  * @param nPushed : the count of elements that were pushed.
+  * @param nDropped : the count of elements that were not pushed, because 'tryPush' returned false.
+  * @returns true if every pushed element was popped exactly once, in the order in which
+  *          its producer pushed it.
+  */
+  bool analyzeBoundedQueue_(int nProducers, int nPerProducer, bool consume, int * nPushed, int * nDropped) {
+    using namespace imajuscule;
+    constexpr int analyzed_queue_size = 16;
+    struct Element {
+      int producer, idx;
+    };
+    lockfree::BoundedQueue<Element, analyzed_queue_size> q;
+    nProducers = std::max(0, nProducers);
+
+    std::vector<int> pushed(nProducers, 0), popped(nProducers, 0), lastIdx(nProducers, -1);
+    std::atomic<int> dropped{0};
+    bool consistent = true;
+    auto const onPopped = [&](Element const & e) {
+      if(e.producer < 0 || e.producer >= nProducers || e.idx <= lastIdx[e.producer]) {
+        consistent = false;
+        return;
+      }
+      lastIdx[e.producer] = e.idx;
+      ++popped[e.producer];
+    };
+
+    std::atomic<bool> start{false}, producersDone{false};
+    std::thread consumer;
+    if(consume) {
+      consumer = std::thread([&]() {
+        Element e;
+        while(true) {
+          if(q.tryPop(e)) {
+            onPopped(e);
+          }
+          else if(producersDone) {
+            break;
+          }
+          else {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    std::vector<std::thread> producers;
+    for(int p=0; p<nProducers; ++p) {
+      producers.emplace_back([&, p]() {
+        // start together, to have contention
+        while(!start) {
+          std::this_thread::yield();
+        }
+        for(int i=0; i<nPerProducer; ++i) {
+          if(q.tryPush({p, i})) {
+            ++pushed[p];
+          }
+          else {
+            ++dropped;
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    start = true;
+    for(auto & t : producers) {
+      t.join();
+    }
+    producersDone = true;
+    if(consumer.joinable()) {
+      consumer.join();
+    }
+    // the elements that were not consumed
+    Element e;
+    while(q.tryPop(e)) {
+      onPopped(e);
+    }
+    *nPushed = 0;
+    for(int p=0; p<nProducers; ++p) {
+      *nPushed += pushed[p];
+      if(pushed[p] != popped[p]) {
+        consistent = false;
+      }
+    }
+    *nDropped = dropped;
+    return consistent && q.empty();
+  }
+
+
   bool effectOn(int program, int16_t pitch, float velocity) {
     using namespace imajuscule::audio;
     if(unlikely(!getAudioContext().Initialized())) {
       return false;
     }
-    auto voicing = Voicing(program,pitch,velocity,0.f,true,0);
-    return convert(playOneThing(windVoice(),getAudioContext().getChannelHandler(),*getXfadeChannels(),voicing));
+    return convert(windVoices().noteOn(program, pitch, velocity));
   }
 
   bool effectOff(int16_t pitch) {
@@ -299,7 +1039,7 @@ extern "C" {
     if(unlikely(!getAudioContext().Initialized())) {
       return false;
     }
-    return convert(stopPlaying(windVoice(),getAudioContext().getChannelHandler(),*getXfadeChannels(),pitch));
+    return convert(windVoices().noteOff(pitch));
   }
 
   bool getConvolutionReverbSignature_(const char * dirPath, const char * filePath, spaceResponse_t * r) {
@@ -312,6 +1052,7 @@ extern "C" {
     if(unlikely(!getAudioContext().Initialized())) {
       return false;
     }
+    onEngineEvent();
     dontUseConvolutionReverbs(getAudioContext().getChannelHandler());
     return true;
   }
@@ -320,6 +1061,7 @@ extern "C" {
     if(unlikely(!getAudioContext().Initialized())) {
       return false;
     }
+    onEngineEvent();
     return useConvolutionReverb(getAudioContext().getChannelHandler(), dirPath, filePath, rts);
   }
   bool setReverbWetRatio(double wet) {
@@ -327,11 +1069,123 @@ extern "C" {
     if(unlikely(!getAudioContext().Initialized())) {
       return false;
     }
+    onEngineEvent();
     getAudioContext().getChannelHandler().enqueueOneShot([wet](auto & chans) {
       chans.getPost().transitionConvolutionReverbWetRatio(wet);
     });
     return true;
   }
+
+  /*
+  * When enabled, the cpu governor degrades the audio quality when the audio callback
+  * is close to its deadline, and restores it when the load is low again.
+  *
+  * It is disabled by default.
+  */
+  void setCpuGovernor(bool enable) {
+    using namespace imajuscule::audio;
+    cpuGovernor().enable(enable);
+  }
+
+  /*
+  * Retrieves the moving average of the load of the audio callback (1 means that the callback
+  * took as long as the duration of the audio it computed), the count of callbacks
+  * that took longer than that, and the current quality level of the cpu governor.
+  */
+  void getCallbackLoad_(float * averageLoad, uint64_t * nOverruns, int * qualityLevel) {
+    using namespace imajuscule::audio;
+    auto const & l = callbackLoad();
+    *averageLoad = l.average.load(std::memory_order_relaxed);
+    *nOverruns = l.nOverruns.load(std::memory_order_relaxed);
+    *qualityLevel = cpuGovernor().level();
+  }
+
+  /*
+  * Returns the count of quality level changes made by the cpu governor.
+  */
+  uint64_t countCpuGovernorAdjustments_() {
+    using namespace imajuscule::audio;
+    return cpuGovernor().countAdjustments();
+  }
+
+  /*
+  * Retrieves a quality level change made by the cpu governor.
+  *
+  * @param index : in [0, countCpuGovernorAdjustments_())
+  * @returns false if the adjustment is too old to be retrieved.
+  */
+  bool getCpuGovernorAdjustment_(uint64_t index, uint64_t * nanos, int * fromLevel, int * toLevel,
+                                 float * averageLoad, float * peakLoad) {
+    using namespace imajuscule::audio;
+    GovernorAdjustment a;
+    if(!cpuGovernor().getAdjustment(index, a)) {
+      return false;
+    }
+    *nanos = a.nanos;
+    *fromLevel = a.fromLevel;
+    *toLevel = a.toLevel;
+    *averageLoad = a.averageLoad;
+    *peakLoad = a.peakLoad;
+    return true;
+  }
+
+  /*
+  * Returns the instruction set used by the SIMD FFT, see 'imajuscule::simdfft::InstructionSet'.
+  */
+  int simdFFTInstructionSet_() {
+    using namespace imajuscule::simdfft;
+    return static_cast<int>(instructionSet());
+  }
+
+  /*
+  * Returns the maximum error of the SIMD FFT of size n, relatively to the maximum
+  * magnitude of the spectrum, or -1 if n is not a power of 2 >= 4.
+  */
+  double analyzeSimdFFTError_(int n) {
+    using namespace imajuscule::simdfft;
+    if(n < 4 || (n & (n-1))) {
+      return -1.;
+    }
+    return maxRelativeError(n);
+  }
+
+  /*
+  * Measures the average durations of forward real FFTs of size n, using the slow FFT
+  * of the audio engine (see the 'SlowFFT' flag) and the SIMD FFT.
+  *
+  * @returns false if n is not a power of 2 >= 4.
+  */
+  bool benchmarkFFT_(int n, int nIterations, double * slowNanos, double * simdNanos) {
+    using namespace imajuscule::simdfft;
+    if(n < 4 || (n & (n-1))) {
+      return false;
+    }
+    auto const b = benchmark(n, nIterations);
+    *slowNanos = b.slowNanos;
+    *simdNanos = b.simdNanos;
+    return true;
+  }
+
+  /*
+  * Retrieves statistics about idle audio callbacks:
+  * when no note is playing and the reverb tail has decayed, the audio callback
+  * writes zeros and steps the audio engine for 0 frames, until an event is sent to the audio engine ("wake up").
+  *
+  * Durations are in nanoseconds.
+  */
+  void getIdleStats_(bool * isIdle, uint64_t * nActiveCallbacks, uint64_t * nIdleCallbacks,
+                     uint64_t * nSleeps, uint64_t * nWakeUps,
+                     uint64_t * idleNanos, uint64_t * maxIdleNanos) {
+    using namespace imajuscule::audio;
+    auto const & s = idleStats();
+    *isIdle = s.idle.load(std::memory_order_relaxed);
+    *nActiveCallbacks = s.nActiveCallbacks.load(std::memory_order_relaxed);
+    *nIdleCallbacks = s.nIdleCallbacks.load(std::memory_order_relaxed);
+    *nSleeps = s.nSleeps.load(std::memory_order_relaxed);
+    *nWakeUps = s.nWakeUps.load(std::memory_order_relaxed);
+    *idleNanos = s.idleNanos.load(std::memory_order_relaxed);
+    *maxIdleNanos = s.maxIdleNanos.load(std::memory_order_relaxed);
+  }
 }
 
 #endif
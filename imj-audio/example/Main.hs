@@ -6,9 +6,10 @@
 module Main where
 
 import           Control.Concurrent(threadDelay)
-import           Control.Monad(void)
+import           Control.Monad(forM_, void)
 
 import           Imj.Audio
+import           Imj.Audio.FFT
 import           Imj.Music.Compositions.Tech
 import           Imj.Music.Compositions.Tchaikovski
 import           Imj.Music.Compositions.Vivaldi
@@ -24,6 +25,10 @@ main = void $ usingAudioOutput -- WithMinLatency 0
   _ <- stressTest
   threadDelay 10000
   --}
+  -- comment the following line out to compare the SIMD FFT with the slow FFT:
+  {-
+  fftBenchmarks
+  --}
   putStrLn "playing tech"
   uncurry (flip playVoicesAtTempo techInstrument) tech >>= print
   threadDelay 10000
@@ -40,6 +45,15 @@ main = void $ usingAudioOutput -- WithMinLatency 0
   uncurry (flip playVoicesAtTempo simpleInstrument) tchaikovskiSwanLake >>= print
   threadDelay 10000
 
+-- | Benchmarks the FFT sizes used by the partitioned convolution reverbs.
+fftBenchmarks :: IO ()
+fftBenchmarks =
+  forM_ (map (2^) [7..15 :: Int]) $ \n ->
+    benchmarkFFT n 200 >>= maybe
+      (error $ "invalid FFT size " ++ show n)
+      (\(FFTBenchmark slow simd) ->
+        putStrLn $ "FFT " ++ show n ++ ": slow " ++ show (round slow :: Int) ++ " ns, SIMD " ++ show (round simd :: Int) ++ " ns")
+
 stressTest :: IO PlayResult
 stressTest = playVoicesAtTempo 10000 simpleInstrument $ map (take 1000 . cycle) [voices|
   sol  - .  . .  .   la - .  . si -   -  - .
@@ -12,6 +12,7 @@ module Imj.Audio.Envelope
       , EasedInterpolation(..)
       -- * Analyze envelopes
       , analyzeAHDSREnvelope
+      , analyzeTabulatedEnvelopeError
       -- * Utilities
       , cycleReleaseMode
       , interpolationToCInt, allInterpolations
@@ -99,6 +100,26 @@ analyzeAHDSREnvelope e (AHDSR'Envelope a h d r ai di ri s) =
 foreign import ccall "analyzeAHDSREnvelope_"
   analyzeAHDSREnvelope_ :: CInt -> CInt -> CInt -> CInt -> CInt -> CInt -> CFloat -> CInt -> CInt -> Ptr CInt -> Ptr CInt -> IO (Ptr CDouble)
 
+-- | When tabulated envelopes are used (see 'setTabulatedEnvelopes'), envelope values are read in
+-- a table containing the values returned by 'analyzeAHDSREnvelope', instead of being computed
+-- for every sample.
+--
+-- The values are identical, except when the key is released before the sustain phase is reached:
+-- in that case, the release values are scaled to start from the current envelope value, which is a close
+-- approximation for a 'Linear' release, and a coarser one for other release 'Interpolation's.
+--
+-- This function returns the maximum absolute difference between tabulated and analytic envelope values,
+-- when the key is released at different moments of the attack, decay and sustain phases.
+analyzeTabulatedEnvelopeError :: ReleaseMode
+                              -> AHDSR'Envelope
+                              -> IO Double
+analyzeTabulatedEnvelopeError e (AHDSR'Envelope a h d r ai di ri s) =
+  realToFrac <$>
+    analyzeTabulatedAHDSREnvelopeError_ (fromIntegral $ fromEnum e) (fromIntegral a) (interpolationToCInt ai) (fromIntegral h) (fromIntegral d) (interpolationToCInt di) (realToFrac s) (fromIntegral r) (interpolationToCInt ri)
+
+foreign import ccall "analyzeTabulatedAHDSREnvelopeError_"
+  analyzeTabulatedAHDSREnvelopeError_ :: CInt -> CInt -> CInt -> CInt -> CInt -> CInt -> CFloat -> CInt -> CInt -> IO CDouble
+
 -- https://stackoverflow.com/questions/43372363/releasing-memory-allocated-by-c-runtime-from-haskell
 foreign import ccall "imj_c_free" imj_c_free :: Ptr a -> IO ()
 
@@ -0,0 +1,90 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+{-# LANGUAGE LambdaCase #-}
+
+module Imj.Audio.FFT
+      ( -- * Types
+        FFTInstructionSet(..)
+      , FFTBenchmark(..)
+      -- * Analyze the SIMD FFT
+      , getFFTInstructionSet
+      , analyzeFFTError
+      , benchmarkFFT
+      ) where
+
+import           Data.Bool(bool)
+import           Foreign.C
+import           Foreign.Marshal.Alloc
+import           Foreign.Ptr
+import           Foreign.Storable
+
+
+-- | The instructions used by the SIMD FFT, detected at runtime.
+data FFTInstructionSet =
+    Scalar
+  | SSE2
+  | AVX2
+  deriving(Eq, Show)
+-- in sync with the corresponding C enum
+instance Enum FFTInstructionSet where
+  fromEnum = \case
+    Scalar -> 0
+    SSE2 -> 1
+    AVX2 -> 2
+  toEnum = \case
+    0 -> Scalar
+    1 -> SSE2
+    2 -> AVX2
+    n -> error $ "out of range:" ++ show n
+
+getFFTInstructionSet :: IO FFTInstructionSet
+getFFTInstructionSet =
+  toEnum . fromIntegral <$> simdFFTInstructionSet_
+
+foreign import ccall "simdFFTInstructionSet_"
+  simdFFTInstructionSet_ :: IO CInt
+
+-- | Returns the maximum absolute difference between the spectrums of a random signal
+-- computed by the SIMD FFT and by a double precision naive FFT, relatively to the
+-- maximum magnitude of the spectrum.
+--
+-- Returns 'Nothing' if the size is not a power of 2, greater than or equal to 4.
+analyzeFFTError :: Int
+                -- ^ The size of the FFT
+                -> IO (Maybe Double)
+analyzeFFTError n = do
+  err <- analyzeSimdFFTError_ (fromIntegral n)
+  return $ if err < 0
+    then Nothing
+    else Just $ realToFrac err
+
+foreign import ccall "analyzeSimdFFTError_"
+  analyzeSimdFFTError_ :: CInt -> IO CDouble
+
+data FFTBenchmark = FFTBenchmark {
+    slowNanos :: !Double
+    -- ^ The average duration of a slow FFT (the one used by the audio engine
+    -- when the @SlowFFT@ flag is set), in nanoseconds.
+  , simdNanos :: !Double
+    -- ^ The average duration of a SIMD FFT, in nanoseconds.
+} deriving(Show)
+
+-- | Measures the average durations of forward real FFTs, using the slow FFT of the audio engine
+-- and the SIMD FFT.
+--
+-- Returns 'Nothing' if the size is not a power of 2, greater than or equal to 4.
+benchmarkFFT :: Int
+             -- ^ The size of the FFT
+             -> Int
+             -- ^ The count of iterations
+             -> IO (Maybe FFTBenchmark)
+benchmarkFFT n nIterations =
+  alloca $ \slowPtr ->
+  alloca $ \simdPtr ->
+    benchmarkFFT_ (fromIntegral n) (fromIntegral nIterations) slowPtr simdPtr >>= bool
+      (return Nothing)
+      (fmap Just $ FFTBenchmark
+        <$> (realToFrac <$> peek slowPtr)
+        <*> (realToFrac <$> peek simdPtr))
+
+foreign import ccall "benchmarkFFT_"
+  benchmarkFFT_ :: CInt -> CInt -> Ptr CDouble -> Ptr CDouble -> IO Bool
@@ -29,11 +29,60 @@ module Imj.Audio.Output
       ( -- * Bracketed init / teardown
         usingAudioOutput
       , usingAudioOutputWithMinLatency
+      , setWindVoicesCount
+      , setTabulatedEnvelopes
       -- * Avoiding MIDI jitter
       , setMaxMIDIJitter
       -- * Playing music
       , play
       , MusicalEvent(..)
+      -- ** Non-blocking
+      , InstrumentHandle
+      , registerInstrument
+      , playNonBlocking
+      , setMidiChannelInstrument
+      , playMidiBytes
+      , MidiNoteMessage(..)
+      , analyzeMidiBytes
+      , MidiRoutingStep(..)
+      , RoutedNote(..)
+      , analyzeMidiRouting
+      , NonBlockingResult(..)
+      , BoundedQueueStats(..)
+      , analyzeBoundedQueue
+      -- * Voice stealing
+      , VoiceStealing(..)
+      , setVoiceStealing
+      , setMaxVoicesPerInstrument
+      , HeldVoice(..)
+      , analyzeVoiceStealing
+      , VoiceStats(..)
+      , getVoiceStats
+      , getRegisteredVoiceStats
+      -- * Cpu accounting
+      , EngineCycles(..)
+      , getEngineCycles
+      -- * Cpu governor
+      , setCpuGovernor
+      , CallbackLoad(..)
+      , getCallbackLoad
+      , CpuGovernorAdjustment(..)
+      , getCpuGovernorAdjustments
+      -- * Idle audio engine
+      , IdleStats(..)
+      , getIdleStats
+      -- * Output levels
+      , ChannelLevels(..)
+      , getOutputLevels
+      , OutputLevelsError(..)
+      , analyzeOutputLevels
+      -- * Capturing the audio output
+      , setOutputCapture
+      , readOutputCapture
+      , OutputCaptureOverruns(..)
+      , getOutputCaptureOverruns
+      , startWavRecording
+      , stopWavRecording
       -- * Postprocessing
       , getReverbInfo
       , useReverb
@@ -93,10 +142,12 @@ module Imj.Audio.Output
 import           Control.Monad.IO.Unlift(MonadUnliftIO, liftIO)
 import           Data.Bool(bool)
 import           Data.Text(Text)
+import           Data.Word(Word8, Word64)
 import qualified Data.Vector.Storable as S
-import           Foreign.C(CInt(..), CULLong(..), CShort(..), CFloat(..), CDouble(..), CString, withCString)
-import           Foreign.ForeignPtr(withForeignPtr)
+import           Foreign.C(CBool(..), CInt(..), CULLong(..), CShort(..), CFloat(..), CDouble(..), CString, withCString)
+import           Foreign.ForeignPtr(withForeignPtr, mallocForeignPtrArray)
 import           Foreign.Marshal.Alloc
+import           Foreign.Marshal.Array(allocaArray, peekArray, withArray, withArrayLen)
 import           Foreign.Ptr(Ptr)
 import           Foreign.Storable
 import           UnliftIO.Exception(bracket)
@@ -240,6 +291,626 @@ midiNoteOnAHDSR osc t (AHDSR'Envelope a h d r ai di ri s) har i v mayMidi =
   src  = fromIntegral $ maybe (-1 :: CInt) (fromIntegral . unMidiSourceIdx . source) mayMidi
   time = fromIntegral $ maybe 0 timestamp mayMidi
 
+-- | A handle to an 'Instrument' registered with 'registerInstrument'.
+newtype InstrumentHandle = InstrumentHandle CInt
+  deriving (Show, Eq, Ord)
+
+-- | Registers an 'Instrument', so that its notes can be played with 'playNonBlocking'.
+--
+-- Registering the same 'Instrument' twice returns the same handle.
+-- Returns 'Nothing' when too many different 'Instrument's (1024) were registered.
+registerInstrument :: Instrument -> IO (Maybe InstrumentHandle)
+registerInstrument i = toHandle <$> case i of
+  Synth osc har e (AHDSR'Envelope a h d r ai di ri s) ->
+    withForeignPtr harPtr $ \harmonicsPtr ->
+      registerInstrumentAHDSR_ (fromIntegral $ fromEnum osc) (fromIntegral $ fromEnum e)
+        (fromIntegral a) (interpolationToCInt ai) (fromIntegral h) (fromIntegral d) (interpolationToCInt di) (realToFrac s) (fromIntegral r) (interpolationToCInt ri)
+        harmonicsPtr (fromIntegral harmonicsSz)
+   where
+    (harPtr, harmonicsSz) = S.unsafeToForeignPtr0 $ unHarmonics har
+  Wind k -> registerWindInstrument_ $ fromIntegral k
+ where
+  toHandle h
+    | h < 0 = Nothing
+    | otherwise = Just $ InstrumentHandle h
+
+foreign import ccall "registerInstrumentAHDSR_"
+  registerInstrumentAHDSR_ :: CInt -> CInt
+                           -> CInt -> CInt -> CInt -> CInt -> CInt -> CFloat -> CInt -> CInt
+                           -> Ptr HarmonicProperties -> CInt
+                           -> IO CInt
+foreign import ccall "registerWindInstrument_" registerWindInstrument_ :: CInt -> IO CInt
+
+data NonBlockingResult =
+    Enqueued
+    -- ^ The note will be played shortly.
+  | WouldBlock
+    -- ^ The note was not played, because the queue of notes was full.
+  | InvalidInstrumentHandle
+  | AudioOutputNotInitialized
+  | InvalidMidiSource
+    -- ^ The MIDI source is out of range.
+  deriving (Show, Eq)
+-- in sync with the corresponding C enum
+instance Enum NonBlockingResult where
+  fromEnum = \case
+    Enqueued -> 0
+    WouldBlock -> 1
+    InvalidInstrumentHandle -> 2
+    AudioOutputNotInitialized -> 3
+    InvalidMidiSource -> 4
+  toEnum = \case
+    0 -> Enqueued
+    1 -> WouldBlock
+    2 -> InvalidInstrumentHandle
+    3 -> AudioOutputNotInitialized
+    4 -> InvalidMidiSource
+    n -> error $ "out of range:" ++ show n
+
+-- | Like 'play', except that this function never allocates and doesn't wait on the audio engine:
+-- the note is enqueued in a lock-free queue, and will be played by a dedicated thread.
+-- When that thread is sleeping, it is woken up by posting to a semaphore, which
+-- doesn't lock but makes a system call.
+--
+-- Hence it is cheap, and can be called from time-critical code, for example
+-- from a thread reading MIDI input.
+playNonBlocking :: MusicalEvent InstrumentHandle
+                -> IO NonBlockingResult
+playNonBlocking = fmap (toEnum . fromIntegral) . \case
+  StartNote mayMidi n@(InstrumentNote _ _ (InstrumentHandle h)) (NoteVelocity v) ->
+    let (MidiPitch pitch) = instrumentNoteToMidiPitch n
+    in noteOnNonBlocking_ h pitch (CFloat v) (midiSrc mayMidi) (midiTime mayMidi)
+  StopNote mayMidi n@(InstrumentNote _ _ (InstrumentHandle h)) ->
+    let (MidiPitch pitch) = instrumentNoteToMidiPitch n
+    in noteOffNonBlocking_ h pitch (midiSrc mayMidi) (midiTime mayMidi)
+ where
+  -- -1 encodes "no source"
+  midiSrc = fromIntegral . maybe (-1 :: CInt) (fromIntegral . unMidiSourceIdx . source)
+  midiTime = fromIntegral . maybe 0 timestamp
+
+-- These functions return quickly, so we can use 'unsafe' calls.
+foreign import ccall unsafe "noteOnNonBlocking_"
+  noteOnNonBlocking_ :: CInt -> CShort -> CFloat -> CInt -> CULLong -> IO CInt
+foreign import ccall unsafe "noteOffNonBlocking_"
+  noteOffNonBlocking_ :: CInt -> CShort -> CInt -> CULLong -> IO CInt
+
+-- | Assigns an instrument to a MIDI channel (0..15), for 'playMidiBytes'.
+--
+-- Passing 'Nothing' makes 'playMidiBytes' ignore the notes of the channel.
+--
+-- Returns 'False' if the channel is out of range.
+setMidiChannelInstrument :: Int
+                         -- ^ The MIDI channel
+                         -> Maybe InstrumentHandle
+                         -> IO Bool
+setMidiChannelInstrument channel =
+  setMidiChannelInstrument_ (fromIntegral channel) . maybe (-1) (\(InstrumentHandle h) -> h)
+
+foreign import ccall "setMidiChannelInstrument_"
+  setMidiChannelInstrument_ :: CInt -> CInt -> IO Bool
+
+-- | Parses raw MIDI 1.0 bytes received from a MIDI source, and plays their note on
+-- messages using the instruments assigned to their channel (see 'setMidiChannelInstrument').
+-- A note off is played by the instrument that played the corresponding note on, even if
+-- the instrument of the channel changed in-between (see 'analyzeMidiRouting').
+--
+-- The parsing is done in C++, and supports running status. A message can be split
+-- across consecutive calls for the same source. Other messages are ignored.
+--
+-- Like 'playNonBlocking', this function never locks, never allocates and doesn't wait on the audio engine.
+-- The bytes of a given source should be passed by a single thread.
+--
+-- Returns 'WouldBlock' if at least one note was dropped because the queue of notes was full.
+playMidiBytes :: MidiInfo
+              -> S.Vector Word8
+              -> IO NonBlockingResult
+playMidiBytes (MidiInfo time src) bytes =
+  fmap (toEnum . fromIntegral) $
+    S.unsafeWith bytes $ \ptr ->
+      midiBytes_ (fromIntegral $ unMidiSourceIdx src) (fromIntegral time) ptr (fromIntegral $ S.length bytes)
+
+-- Like 'noteOnNonBlocking_', this function returns quickly.
+foreign import ccall unsafe "midiBytes_"
+  midiBytes_ :: CInt -> CULLong -> Ptr Word8 -> CInt -> IO CInt
+
+-- | A note on / note off message parsed by 'analyzeMidiBytes'.
+data MidiNoteMessage = MidiNoteMessage {
+    midiChannel :: {-# UNPACK #-} !Int
+  , midiNoteOn :: !Bool
+    -- ^ 'False' for a note off, or a note on with a velocity of 0.
+  , midiPitch :: {-# UNPACK #-} !Int
+  , midiVelocity :: {-# UNPACK #-} !Int
+} deriving (Show, Eq)
+
+-- | Parses raw MIDI 1.0 bytes like 'playMidiBytes' does, passing them to a new parser
+-- in chunks of the given size, and returns the note on / note off messages.
+analyzeMidiBytes :: Int
+                 -- ^ The size of the chunks
+                 -> [Word8]
+                 -> IO [MidiNoteMessage]
+analyzeMidiBytes chunkSize bytes =
+  withArrayLen bytes $ \n bytesPtr -> do
+    -- a message has at least 2 bytes
+    let maxMessages = n `div` 2
+    allocaArray (4 * maxMessages) $ \messagesPtr -> do
+      nMessages <- analyzeMidiBytes_ bytesPtr (fromIntegral n) (fromIntegral chunkSize) messagesPtr (fromIntegral maxMessages)
+      map toMessage . chunksOf4 <$> peekArray (4 * fromIntegral (max 0 nMessages)) messagesPtr
+ where
+  chunksOf4 (a:b:c:d:rest) = [a,b,c,d] : chunksOf4 rest
+  chunksOf4 _ = []
+  toMessage = \case
+    [c, on, p, v] -> MidiNoteMessage (fromIntegral c) (on /= 0) (fromIntegral p) (fromIntegral v)
+    l -> error $ "invalid message:" ++ show l
+
+foreign import ccall "analyzeMidiBytes_"
+  analyzeMidiBytes_ :: Ptr Word8 -> CInt -> CInt -> Ptr Word8 -> CInt -> IO CInt
+
+-- | A step of 'analyzeMidiRouting'.
+data MidiRoutingStep =
+    AssignChannel !Int !(Maybe Int)
+    -- ^ Like 'setMidiChannelInstrument', using an arbitrary number to identify the instrument.
+  | PassBytes ![Word8]
+    -- ^ Like 'playMidiBytes'.
+  deriving (Show, Eq)
+
+-- | A note event produced by 'analyzeMidiRouting'.
+data RoutedNote = RoutedNote {
+    routedInstrument :: {-# UNPACK #-} !Int
+  , routedNoteOn :: !Bool
+  , routedPitch :: {-# UNPACK #-} !Int
+} deriving (Show, Eq)
+
+-- | Returns the note events that 'playMidiBytes' would play, and the instruments playing them,
+-- using a new MIDI input.
+analyzeMidiRouting :: [MidiRoutingStep] -> IO [RoutedNote]
+analyzeMidiRouting steps =
+  withArrayLen (concatMap encode steps) $ \n stepsPtr -> do
+    let nSteps = n `div` 3
+        -- a note on may stop the note of another instrument
+        maxEvents = 2 * nSteps
+    allocaArray (3 * maxEvents) $ \eventsPtr -> do
+      nEvents <- analyzeMidiRouting_ stepsPtr (fromIntegral nSteps) eventsPtr (fromIntegral maxEvents)
+      map toEvent . chunksOf3 <$> peekArray (3 * fromIntegral (max 0 nEvents)) eventsPtr
+ where
+  encode = \case
+    AssignChannel c i -> [0, fromIntegral c, maybe (-1) fromIntegral i]
+    PassBytes bytes -> concatMap (\b -> [1, fromIntegral b, 0]) bytes
+  chunksOf3 (a:b:c:rest) = [a,b,c] : chunksOf3 rest
+  chunksOf3 _ = []
+  toEvent = \case
+    [i, on, p] -> RoutedNote (fromIntegral i) (on /= 0) (fromIntegral p)
+    l -> error $ "invalid event:" ++ show l
+
+foreign import ccall "analyzeMidiRouting_"
+  analyzeMidiRouting_ :: Ptr CInt -> CInt -> Ptr CInt -> CInt -> IO CInt
+
+-- | The result of 'analyzeBoundedQueue'.
+data BoundedQueueStats = BoundedQueueStats {
+    queueConsistent :: !Bool
+    -- ^ 'True' if every pushed element was popped exactly once, in the order in which
+    -- its producer pushed it.
+  , queuePushed :: {-# UNPACK #-} !Int
+  , queueDropped :: {-# UNPACK #-} !Int
+    -- ^ The count of elements that were not pushed because the queue was full.
+} deriving (Show, Eq)
+
+-- | Tests the lock-free queue used by 'playNonBlocking' and 'playMidiBytes', using
+-- a queue of 16 elements: each producer thread pushes its elements without waiting,
+-- while a consumer thread pops them (when the 'Bool' is 'True').
+analyzeBoundedQueue :: Int
+                    -- ^ The count of producer threads
+                    -> Int
+                    -- ^ The count of elements pushed by each producer
+                    -> Bool
+                    -- ^ Whether elements are popped while producers push elements
+                    -> IO BoundedQueueStats
+analyzeBoundedQueue nProducers nPerProducer consume =
+  alloca $ \pPushed -> alloca $ \pDropped -> do
+    consistent <- analyzeBoundedQueue_ (fromIntegral nProducers) (fromIntegral nPerProducer) consume pPushed pDropped
+    BoundedQueueStats consistent
+      <$> (fromIntegral <$> peek pPushed)
+      <*> (fromIntegral <$> peek pDropped)
+
+foreign import ccall "analyzeBoundedQueue_"
+  analyzeBoundedQueue_ :: CInt -> CInt -> Bool -> Ptr CInt -> Ptr CInt -> IO Bool
+
+-- | What happens when an 'Instrument' has no free channel to play a new note.
+--
+-- Stolen voices fade out in a few milliseconds, so stealing a voice doesn't produce
+-- an audible click, and the new note starts once the stolen voice has faded out.
+-- Voices of 'Instrument's using 'AutoRelease' can be stolen too.
+data VoiceStealing =
+    NoVoiceStealing
+    -- ^ The new note is dropped.
+  | StealOldest
+    -- ^ The voice that started first is released.
+  | StealQuietest
+    -- ^ The voice with the lowest (estimated) envelope level is released.
+  | RetriggerSamePitch
+    -- ^ A held voice of the same pitch is released, even if the 'Instrument' has free channels.
+    -- Else, behaves like 'StealOldest'.
+  deriving (Show, Eq)
+-- in sync with the corresponding C enum
+instance Enum VoiceStealing where
+  fromEnum = \case
+    NoVoiceStealing -> 0
+    StealOldest -> 1
+    StealQuietest -> 2
+    RetriggerSamePitch -> 3
+  toEnum = \case
+    0 -> NoVoiceStealing
+    1 -> StealOldest
+    2 -> StealQuietest
+    3 -> RetriggerSamePitch
+    n -> error $ "out of range:" ++ show n
+
+-- | A voice held by an 'Instrument', see 'analyzeVoiceStealing'.
+data HeldVoice = HeldVoice {
+    heldPitch :: {-# UNPACK #-} !Int
+  , heldVelocity :: {-# UNPACK #-} !Float
+  , heldSince :: {-# UNPACK #-} !Int
+    -- ^ The MIDI time at which the voice started, in frames.
+} deriving (Show, Eq)
+
+-- | Returns the index of the voice that a 'VoiceStealing' policy steals to play a new note,
+-- or 'Nothing' if no voice is stolen.
+analyzeVoiceStealing :: VoiceStealing
+                     -> ReleaseMode
+                     -> AHDSR'Envelope
+                     -- ^ The envelope of the voices
+                     -> [HeldVoice]
+                     -- ^ The held voices, ordered by start time (at most 64)
+                     -> Int
+                     -- ^ The maximum count of voices held by the 'Instrument'
+                     -> Int
+                     -- ^ The pitch of the new note
+                     -> Int
+                     -- ^ The MIDI time of the new note, in frames
+                     -> IO (Maybe Int)
+analyzeVoiceStealing policy e (AHDSR'Envelope a h d r _ _ _ s) voices maxVoices pitch now =
+  withArrayLen (map (fromIntegral . heldPitch) voices) $ \n pitchesPtr ->
+  withArray (map (CFloat . heldVelocity) voices) $ \velocitiesPtr ->
+  withArray (map (fromIntegral . heldSince) voices) $ \startsPtr -> do
+    i <- analyzeVoiceStealing_ (fromIntegral $ fromEnum policy) (fromIntegral $ fromEnum e)
+      (fromIntegral a) (fromIntegral h) (fromIntegral d) (realToFrac s) (fromIntegral r)
+      (fromIntegral n) pitchesPtr velocitiesPtr startsPtr
+      (fromIntegral maxVoices) (fromIntegral pitch) (fromIntegral now)
+    return $ if i < 0
+      then Nothing
+      else Just $ fromIntegral i
+
+foreign import ccall "analyzeVoiceStealing_"
+  analyzeVoiceStealing_ :: CInt -> CInt -> CInt -> CInt -> CInt -> CFloat -> CInt -> CInt -> Ptr CShort -> Ptr CFloat -> Ptr CInt -> CInt -> CShort -> CInt -> IO CInt
+
+-- | Per-'Instrument' voice statistics.
+data VoiceStats = VoiceStats {
+    heldVoices :: {-# UNPACK #-} !Int
+    -- ^ Count of voices that are currently held.
+  , stolenVoices :: {-# UNPACK #-} !Int
+    -- ^ Count of voices that were stolen to play a new note.
+  , droppedNotes :: {-# UNPACK #-} !Int
+    -- ^ Count of notes that were not played, because no voice was available,
+    -- or because the channel of a stolen voice was not freed in time.
+  , estimatedCpuCycles :: {-# UNPACK #-} !Word64
+    -- ^ Cpu cycles attributed to the 'Instrument': this is an estimation, because the audio engine
+    -- doesn't measure the cost of 'Instrument's individually (see 'EngineCycles').
+} deriving (Show, Eq)
+
+foreign import ccall "setVoiceStealing" setVoiceStealing_ :: CInt -> IO ()
+
+-- | Sets the 'VoiceStealing' policy, for all 'Instrument's. The default is 'NoVoiceStealing'.
+setVoiceStealing :: VoiceStealing -> IO ()
+setVoiceStealing = setVoiceStealing_ . fromIntegral . fromEnum
+
+foreign import ccall "setMaxVoicesPerInstrument" setMaxVoicesPerInstrument_ :: CInt -> IO ()
+
+-- | Limits the count of voices that a single 'Instrument' can hold simultaneously,
+-- to bound the cpu usage. When the limit is reached, the 'VoiceStealing' policy applies.
+--
+-- 0 removes the limit.
+setMaxVoicesPerInstrument :: Int -> IO ()
+setMaxVoicesPerInstrument = setMaxVoicesPerInstrument_ . fromIntegral
+
+-- | Returns 'Nothing' if the 'Instrument' has not been played yet, or if it is not a 'Synth'.
+getVoiceStats :: Instrument -> IO (Maybe VoiceStats)
+getVoiceStats = \case
+  Synth osc har e (AHDSR'Envelope a h d r ai di ri s) ->
+    withForeignPtr harPtr $ \harmonicsPtr -> peekVoiceStats $
+      getVoiceStatsAHDSR_ (fromIntegral $ fromEnum osc) (fromIntegral $ fromEnum e)
+        (fromIntegral a) (interpolationToCInt ai) (fromIntegral h) (fromIntegral d) (interpolationToCInt di) (realToFrac s) (fromIntegral r) (interpolationToCInt ri)
+        harmonicsPtr (fromIntegral harmonicsSz)
+   where
+    (harPtr, harmonicsSz) = S.unsafeToForeignPtr0 $ unHarmonics har
+  Wind _ -> return Nothing
+
+-- | Same as 'getVoiceStats', for a registered 'Instrument'.
+getRegisteredVoiceStats :: InstrumentHandle -> IO (Maybe VoiceStats)
+getRegisteredVoiceStats (InstrumentHandle h) = peekVoiceStats $ getRegisteredVoiceStats_ h
+
+peekVoiceStats :: (Ptr CInt -> Ptr CInt -> Ptr CInt -> Ptr CULLong -> IO Bool)
+               -> IO (Maybe VoiceStats)
+peekVoiceStats get =
+  alloca $ \pHeld -> alloca $ \pSteals -> alloca $ \pDrops -> alloca $ \pCycles ->
+    get pHeld pSteals pDrops pCycles >>= bool
+      (return Nothing)
+      (fmap Just $ VoiceStats
+        <$> (fromIntegral <$> peek pHeld)
+        <*> (fromIntegral <$> peek pSteals)
+        <*> (fromIntegral <$> peek pDrops)
+        <*> (fromIntegral <$> peek pCycles))
+
+foreign import ccall "getVoiceStatsAHDSR_"
+  getVoiceStatsAHDSR_ :: CInt -> CInt
+                      -> CInt -> CInt -> CInt -> CInt -> CInt -> CFloat -> CInt -> CInt
+                      -> Ptr HarmonicProperties -> CInt
+                      -> Ptr CInt -> Ptr CInt -> Ptr CInt -> Ptr CULLong
+                      -> IO Bool
+foreign import ccall "getRegisteredVoiceStats_"
+  getRegisteredVoiceStats_ :: CInt -> Ptr CInt -> Ptr CInt -> Ptr CInt -> Ptr CULLong -> IO Bool
+
+-- | The audio engine computes all voices and the post-processing at once, so only the total
+-- count of cpu cycles it spends is measured. These cycles are attributed to 'Instrument's
+-- proportionally to their estimated workload (count of voices * count of harmonics), after
+-- having subtracted the estimated cost of the post-processing (measured when no voice is playing):
+-- the attributed cycles are estimations.
+--
+-- On x86, cycles are cpu cycles, on other platforms they are nanoseconds.
+data EngineCycles = EngineCycles {
+    totalCycles :: {-# UNPACK #-} !Word64
+    -- ^ Cycles spent computing audio, measured.
+  , estimatedPostProcessingCycles :: {-# UNPACK #-} !Word64
+    -- ^ Cycles attributed to the post-processing (reverb, mixing).
+  , estimatedWindCycles :: {-# UNPACK #-} !Word64
+    -- ^ Cycles attributed to the 'Wind' voices.
+} deriving (Show, Eq)
+
+getEngineCycles :: IO EngineCycles
+getEngineCycles =
+  alloca $ \pTotal -> alloca $ \pPost -> alloca $ \pWind -> do
+    getEngineCycles_ pTotal pPost pWind
+    EngineCycles
+      <$> (fromIntegral <$> peek pTotal)
+      <*> (fromIntegral <$> peek pPost)
+      <*> (fromIntegral <$> peek pWind)
+
+foreign import ccall "getEngineCycles_"
+  getEngineCycles_ :: Ptr CULLong -> Ptr CULLong -> Ptr CULLong -> IO ()
+
+foreign import ccall "setCpuGovernor" setCpuGovernor_ :: Bool -> IO ()
+
+-- | When 'True', the audio quality is progressively degraded when the audio callback
+-- is close to its deadline (to avoid audio glitches), and progressively restored
+-- when the load is low again. The quality is degraded by:
+--
+-- * not playing the high harmonics (of new notes), starting with the quietest ones,
+-- * limiting the count of voices per 'Instrument' (see 'VoiceStealing').
+--
+-- The default is 'False'.
+setCpuGovernor :: Bool -> IO ()
+setCpuGovernor = setCpuGovernor_
+
+-- | The load of the audio callback is the duration of the audio callback divided by
+-- the duration of the audio it computes.
+data CallbackLoad = CallbackLoad {
+    averageLoad :: {-# UNPACK #-} !Float
+    -- ^ Moving average of the load.
+  , countOverruns :: {-# UNPACK #-} !Word64
+    -- ^ Count of audio callbacks whose load was above 1.
+  , qualityLevel :: {-# UNPACK #-} !Int
+    -- ^ The quality level chosen by the cpu governor, 0 is the best quality.
+} deriving (Show)
+
+getCallbackLoad :: IO CallbackLoad
+getCallbackLoad =
+  alloca $ \pAverage -> alloca $ \pOverruns -> alloca $ \pLevel -> do
+    getCallbackLoad_ pAverage pOverruns pLevel
+    CallbackLoad
+      <$> (realToFrac <$> peek pAverage)
+      <*> (fromIntegral <$> peek pOverruns)
+      <*> (fromIntegral <$> peek pLevel)
+
+foreign import ccall "getCallbackLoad_"
+  getCallbackLoad_ :: Ptr CFloat -> Ptr CULLong -> Ptr CInt -> IO ()
+
+-- | A quality level change made by the cpu governor.
+data CpuGovernorAdjustment = CpuGovernorAdjustment {
+    adjustmentTime :: !(Time Duration System)
+    -- ^ Since the initialization of the audio output.
+  , fromQualityLevel :: {-# UNPACK #-} !Int
+  , toQualityLevel :: {-# UNPACK #-} !Int
+  , adjustmentAverageLoad :: {-# UNPACK #-} !Float
+  , adjustmentPeakLoad :: {-# UNPACK #-} !Float
+} deriving (Show)
+
+-- | The count of quality level changes kept by the cpu governor.
+--
+-- In sync with 'CpuGovernor::n_max_adjustments' in the C++ code.
+maxCpuGovernorAdjustments :: Int
+maxCpuGovernorAdjustments = 64
+
+-- | Returns the last (at most 'maxCpuGovernorAdjustments') quality level changes
+-- made by the cpu governor since the initialization of the audio output, oldest first.
+getCpuGovernorAdjustments :: IO [CpuGovernorAdjustment]
+getCpuGovernorAdjustments = do
+  n <- fromIntegral <$> countCpuGovernorAdjustments_
+  fmap concat $ mapM get [max 0 (n - maxCpuGovernorAdjustments) .. n - 1]
+ where
+  get :: Int -> IO [CpuGovernorAdjustment]
+  get i =
+    alloca $ \pNanos -> alloca $ \pFrom -> alloca $ \pTo -> alloca $ \pAverage -> alloca $ \pPeak ->
+      getCpuGovernorAdjustment_ (fromIntegral i) pNanos pFrom pTo pAverage pPeak >>= bool
+        (return [])
+        (fmap pure $ CpuGovernorAdjustment
+          <$> (fromMicros . (`quot` 1000) . fromIntegral <$> peek pNanos)
+          <*> (fromIntegral <$> peek pFrom)
+          <*> (fromIntegral <$> peek pTo)
+          <*> (realToFrac <$> peek pAverage)
+          <*> (realToFrac <$> peek pPeak))
+
+foreign import ccall "countCpuGovernorAdjustments_" countCpuGovernorAdjustments_ :: IO CULLong
+foreign import ccall "getCpuGovernorAdjustment_"
+  getCpuGovernorAdjustment_ :: CULLong -> Ptr CULLong -> Ptr CInt -> Ptr CInt -> Ptr CFloat -> Ptr CFloat -> IO Bool
+
+-- | When no note is playing and the reverb tail has decayed below -100 dB,
+-- the audio engine becomes idle: the audio callback writes zeros without synthesizing audio,
+-- until a new event (a note, a reverb change) wakes the audio engine up.
+-- While idle, the audio engine still keeps track of time, to synchronize MIDI events.
+data IdleStats = IdleStats {
+    isIdle :: !Bool
+  , activeCallbacks :: {-# UNPACK #-} !Word64
+    -- ^ Count of audio callbacks that computed audio.
+  , idleCallbacks :: {-# UNPACK #-} !Word64
+    -- ^ Count of audio callbacks that wrote zeros.
+  , countSleeps :: {-# UNPACK #-} !Word64
+    -- ^ Count of transitions from active to idle.
+  , countWakeUps :: {-# UNPACK #-} !Word64
+    -- ^ Count of transitions from idle to active.
+  , idleCallbacksDuration :: !(Time Duration System)
+    -- ^ Cumulated duration of idle audio callbacks (writing zeros and keeping track of time).
+  , maxIdleCallbackDuration :: !(Time Duration System)
+    -- ^ Maximum duration of an idle audio callback.
+} deriving (Show)
+
+getIdleStats :: IO IdleStats
+getIdleStats =
+  alloca $ \pIdle -> alloca $ \pActive -> alloca $ \pIdleCbs -> alloca $ \pSleeps ->
+  alloca $ \pWakeUps -> alloca $ \pNanos -> alloca $ \pMaxNanos -> do
+    getIdleStats_ pIdle pActive pIdleCbs pSleeps pWakeUps pNanos pMaxNanos
+    IdleStats
+      <$> ((/= 0) <$> peek pIdle)
+      <*> (fromIntegral <$> peek pActive)
+      <*> (fromIntegral <$> peek pIdleCbs)
+      <*> (fromIntegral <$> peek pSleeps)
+      <*> (fromIntegral <$> peek pWakeUps)
+      <*> (fromNanos <$> peek pNanos)
+      <*> (fromNanos <$> peek pMaxNanos)
+ where
+  fromNanos = fromMicros . (`quot` 1000) . fromIntegral
+
+foreign import ccall "getIdleStats_"
+  getIdleStats_ :: Ptr CBool -> Ptr CULLong -> Ptr CULLong -> Ptr CULLong -> Ptr CULLong -> Ptr CULLong -> Ptr CULLong -> IO ()
+
+data ChannelLevels = ChannelLevels {
+    callbackPeak :: !Float
+    -- ^ The peak of the last audio callback.
+  , callbackRMS :: !Float
+    -- ^ The RMS of the last audio callback.
+  , peakSinceLastRead :: !Float
+    -- ^ The maximum peak since the previous call to 'getOutputLevels'.
+  , countClippedSamples :: !Word64
+    -- ^ The total count of samples whose absolute value was above 1.
+} deriving(Show)
+
+-- | Returns the levels of every channel of the audio output, measured after the postprocessing.
+--
+-- The levels are measured for every audio callback, with a low overhead.
+getOutputLevels :: IO [ChannelLevels]
+getOutputLevels = do
+  nChannels <- countOutputCaptureChannels_
+  fmap concat $ mapM get [0..nChannels-1]
+ where
+  get c =
+    alloca $ \pPeak -> alloca $ \pRMS -> alloca $ \pMaxPeak -> alloca $ \pClips ->
+      getOutputLevels_ c pPeak pRMS pMaxPeak pClips >>= bool
+        (return [])
+        (fmap pure $ ChannelLevels
+          <$> (realToFrac <$> peek pPeak)
+          <*> (realToFrac <$> peek pRMS)
+          <*> (realToFrac <$> peek pMaxPeak)
+          <*> (fromIntegral <$> peek pClips))
+
+foreign import ccall "getOutputLevels_"
+  getOutputLevels_ :: CInt -> Ptr CFloat -> Ptr CFloat -> Ptr CFloat -> Ptr CULLong -> IO Bool
+
+-- | The differences between the levels measured by the SIMD code used by 'getOutputLevels'
+-- and the levels measured by a scalar reference, for every channel of a pseudo-random signal.
+data OutputLevelsError = OutputLevelsError {
+    peakError :: !Float
+    -- ^ The maximum absolute difference of peaks.
+  , sumSquaresError :: !Float
+    -- ^ The maximum difference of sums of squares, relatively to the sum of squares.
+  , clipsErrors :: {-# UNPACK #-} !Int
+    -- ^ The count of channels whose counts of clipped samples differ.
+} deriving(Show)
+
+-- | Returns 'Nothing' if the count of frames is negative.
+analyzeOutputLevels :: Int
+                    -- ^ The count of frames of the signal
+                    -> IO (Maybe OutputLevelsError)
+analyzeOutputLevels nFrames =
+  alloca $ \pPeak -> alloca $ \pSumSquares -> alloca $ \pClips ->
+    analyzeOutputLevels_ (fromIntegral nFrames) pPeak pSumSquares pClips >>= bool
+      (return Nothing)
+      (fmap Just $ OutputLevelsError
+        <$> (realToFrac <$> peek pPeak)
+        <*> (realToFrac <$> peek pSumSquares)
+        <*> (fromIntegral <$> peek pClips))
+
+foreign import ccall "analyzeOutputLevels_"
+  analyzeOutputLevels_ :: CInt -> Ptr CFloat -> Ptr CFloat -> Ptr CInt -> IO Bool
+
+-- | Enables or disables the capture of the audio output, see 'readOutputCapture'.
+--
+-- Returns 'False' if the capture could not be enabled because a wav recording is in progress.
+setOutputCapture :: Bool -> IO Bool
+setOutputCapture = enableOutputCapture_
+
+foreign import ccall "enableOutputCapture_" enableOutputCapture_ :: Bool -> IO Bool
+
+-- | Reads at most the given count of frames of the captured audio output
+-- (after the postprocessing), as interleaved samples.
+--
+-- The audio output is captured in a buffer of limited size, and frames are dropped
+-- when it is not read fast enough (see 'getOutputCaptureOverruns').
+--
+-- Returns 'Nothing' when the capture is not enabled (see 'setOutputCapture'),
+-- or when another thread is reading the capture.
+readOutputCapture :: Int
+                  -- ^ The maximum count of frames
+                  -> IO (Maybe (S.Vector Float))
+readOutputCapture maxFrames = do
+  nChannels <- fromIntegral <$> countOutputCaptureChannels_
+  fptr <- mallocForeignPtrArray $ nChannels * max 0 maxFrames
+  n <- withForeignPtr fptr $ \ptr ->
+    readOutputCapture_ ptr (fromIntegral maxFrames)
+  return $ if n < 0
+    then Nothing
+    else Just $ S.unsafeFromForeignPtr0 fptr $ nChannels * fromIntegral n
+
+foreign import ccall "countOutputCaptureChannels_" countOutputCaptureChannels_ :: IO CInt
+foreign import ccall "readOutputCapture_" readOutputCapture_ :: Ptr Float -> CInt -> IO CInt
+
+data OutputCaptureOverruns = OutputCaptureOverruns {
+    countOverrunCallbacks :: !Word64
+    -- ^ The count of audio callbacks during which frames were dropped.
+  , countDroppedFrames :: !Word64
+} deriving(Show)
+
+getOutputCaptureOverruns :: IO OutputCaptureOverruns
+getOutputCaptureOverruns =
+  alloca $ \pOverruns -> alloca $ \pDropped -> do
+    getOutputCaptureOverruns_ pOverruns pDropped
+    OutputCaptureOverruns
+      <$> (fromIntegral <$> peek pOverruns)
+      <*> (fromIntegral <$> peek pDropped)
+
+foreign import ccall "getOutputCaptureOverruns_"
+  getOutputCaptureOverruns_ :: Ptr CULLong -> Ptr CULLong -> IO ()
+
+-- | Records the audio output to a wav file (32 bits float samples), until 'stopWavRecording'
+-- is called or the audio output is torn down.
+--
+-- The file is written by a dedicated thread.
+--
+-- Returns 'False' if a recording is already in progress, if the capture is enabled
+-- (see 'setOutputCapture'), or if the file could not be created.
+startWavRecording :: FilePath -> IO Bool
+startWavRecording path =
+  withCString path startWavRecording_
+
+foreign import ccall "startWavRecording_" startWavRecording_ :: CString -> IO Bool
+foreign import ccall "stopWavRecording_" stopWavRecording :: IO ()
+
 
 foreign import ccall "getConvolutionReverbSignature_" getReverbSignature :: CString -> CString -> Ptr SpaceResponse -> IO Bool
 
@@ -288,6 +959,26 @@ setReverbWetRatio =
   fmap (bool (Left ()) (Right ())) .
     setReverbWetRatio_ . realToFrac
 
+foreign import ccall "setTabulatedEnvelopes" setTabulatedEnvelopes_ :: Bool -> IO ()
+
+-- | When 'True', envelope values are read in tables shared by all voices using the same
+-- 'AHDSR'Envelope', instead of being computed for every sample (see 'analyzeTabulatedEnvelopeError').
+-- The default is 'False'.
+--
+-- It is taken into account at the next initialization of the audio output,
+-- so it should be called before 'usingAudioOutput' or 'usingAudioOutputWithMinLatency'.
+setTabulatedEnvelopes :: Bool -> IO ()
+setTabulatedEnvelopes = setTabulatedEnvelopes_
+
+foreign import ccall "setWindVoicesCount" setWindVoicesCount_ :: CInt -> IO ()
+
+-- | Sets the count of voices used to play concurrent 'Wind' notes (the default is 4).
+--
+-- It is taken into account at the next initialization of the audio output,
+-- so it should be called before 'usingAudioOutput' or 'usingAudioOutputWithMinLatency'.
+setWindVoicesCount :: Int -> IO ()
+setWindVoicesCount = setWindVoicesCount_ . fromIntegral
+
 foreign import ccall "effectOn" effectOn :: CInt -> CShort -> CFloat -> IO Bool
 foreign import ccall "effectOff" effectOff :: CShort -> IO Bool
 foreign import ccall "midiNoteOnAHDSR_"
@@ -1,8 +1,20 @@
+import Test.Imj.BoundedQueue
+import Test.Imj.MidiBytes
+import Test.Imj.OutputLevels
 import Test.Imj.ParseMusic
 import Test.Imj.ReadMidi
+import Test.Imj.SimdFFT
+import Test.Imj.TabulatedEnvelope
+import Test.Imj.VoiceStealing
 
 main :: IO ()
 main = do
   testParseMonoVoice
   testParsePolyVoice
   testReadMidi
+  testMidiBytes
+  testBoundedQueue
+  testOutputLevels
+  testSimdFFT
+  testTabulatedEnvelope
+  testVoiceStealing
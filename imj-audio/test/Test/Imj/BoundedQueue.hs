@@ -0,0 +1,22 @@
+module Test.Imj.BoundedQueue
+          ( testBoundedQueue
+          ) where
+
+import           Control.Monad(forM_, unless)
+
+import           Imj.Audio.Output
+
+testBoundedQueue :: IO ()
+testBoundedQueue = do
+  -- without consumer, the queue becomes full and the next elements are dropped
+  expect "full queue" 1 100 False $ \s ->
+    queuePushed s == 16 && queueDropped s == 84
+  forM_ [1, 2, 4] $ \nProducers ->
+    expect (show nProducers ++ " producer(s)") nProducers 10000 True $ \s ->
+      queuePushed s + queueDropped s == nProducers * 10000 && queuePushed s >= 16
+ where
+  expect :: String -> Int -> Int -> Bool -> (BoundedQueueStats -> Bool) -> IO ()
+  expect what nProducers nPerProducer consume check = do
+    s <- analyzeBoundedQueue nProducers nPerProducer consume
+    unless (queueConsistent s && check s) $
+      error $ what ++ ": unexpected " ++ show s
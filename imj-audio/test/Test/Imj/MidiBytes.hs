@@ -0,0 +1,68 @@
+module Test.Imj.MidiBytes
+          ( testMidiBytes
+          ) where
+
+import           Control.Monad(forM_, unless)
+import           Data.Word(Word8)
+
+import           Imj.Audio.Output
+
+testMidiBytes :: IO ()
+testMidiBytes = do
+  expect "note on, note off"
+    [0x90, 60, 100, 0x80, 60, 64]
+    [noteOn 0 60 100, noteOff 0 60 64]
+  expect "channel"
+    [0x95, 60, 100]
+    [noteOn 5 60 100]
+  expect "running status"
+    [0x90, 60, 100, 62, 90, 64, 80]
+    [noteOn 0 60 100, noteOn 0 62 90, noteOn 0 64 80]
+  expect "a note on with a velocity of 0 is a note off"
+    [0x90, 60, 100, 60, 0]
+    [noteOn 0 60 100, noteOff 0 60 0]
+  expect "realtime messages are interleaved"
+    [0x90, 0xF8, 60, 0xFE, 100, 0xFA, 62, 0xFC, 90]
+    [noteOn 0 60 100, noteOn 0 62 90]
+  -- the data bytes of the SysEx are not notes, and the running status is cancelled.
+  expect "SysEx cancels the running status"
+    [0x90, 60, 100, 0xF0, 62, 90, 0xF7, 64, 80, 0x90, 66, 70]
+    [noteOn 0 60 100, noteOn 0 66 70]
+  expect "a program change has a single data byte"
+    [0xC3, 5, 0x93, 60, 100, 0xC3, 5, 6, 7]
+    [noteOn 3 60 100]
+  expect "other channel messages are skipped"
+    [0xB0, 7, 100, 0xE0, 0, 64, 0x90, 60, 100]
+    [noteOn 0 60 100]
+  expect "data bytes without a status are skipped"
+    [60, 100, 0x90, 60, 100]
+    [noteOn 0 60 100]
+  expectRouted "a note off is played by the instrument of the note on"
+    [AssignChannel 0 $ Just 1, PassBytes [0x90, 60, 100], AssignChannel 0 $ Just 2, PassBytes [0x80, 60, 0]]
+    [RoutedNote 1 True 60, RoutedNote 1 False 60]
+  expectRouted "a note off is played when the channel is ignored"
+    [AssignChannel 0 $ Just 1, PassBytes [0x90, 60, 100], AssignChannel 0 Nothing, PassBytes [0x90, 60, 0]]
+    [RoutedNote 1 True 60, RoutedNote 1 False 60]
+  expectRouted "a note off without note on is ignored"
+    [AssignChannel 0 $ Just 1, PassBytes [0x80, 60, 0, 0x90, 62, 100, 0x81, 62, 0]]
+    [RoutedNote 1 True 62]
+  expectRouted "a note on stops the same note of another instrument"
+    [AssignChannel 3 $ Just 1, PassBytes [0x93, 60, 100], AssignChannel 3 $ Just 2, PassBytes [0x93, 60, 100, 0x83, 60, 0]]
+    [RoutedNote 1 True 60, RoutedNote 1 False 60, RoutedNote 2 True 60, RoutedNote 2 False 60]
+ where
+  noteOn c p v = MidiNoteMessage c True p v
+  noteOff c p v = MidiNoteMessage c False p v
+
+  -- the messages must be the same when the bytes are split in several buffers.
+  expect :: String -> [Word8] -> [MidiNoteMessage] -> IO ()
+  expect what bytes expected =
+    forM_ [1, 2, 3, length bytes] $ \chunkSize -> do
+      res <- analyzeMidiBytes chunkSize bytes
+      unless (res == expected) $
+        error $ what ++ " (chunks of " ++ show chunkSize ++ "): expected " ++ show expected ++ ", got " ++ show res
+
+  expectRouted :: String -> [MidiRoutingStep] -> [RoutedNote] -> IO ()
+  expectRouted what steps expected = do
+    res <- analyzeMidiRouting steps
+    unless (res == expected) $
+      error $ what ++ ": expected " ++ show expected ++ ", got " ++ show res
@@ -0,0 +1,22 @@
+module Test.Imj.OutputLevels
+          ( testOutputLevels
+          ) where
+
+import           Control.Monad(forM_, unless)
+
+import           Imj.Audio.Output
+
+testOutputLevels :: IO ()
+testOutputLevels = do
+  -- the counts of samples are not always multiples of the SIMD width,
+  -- and the counts of SIMD vectors are not always even.
+  forM_ [0, 1, 2, 3, 5, 63, 64, 65, 1023, 1024, 1025] $ \nFrames ->
+    analyzeOutputLevels nFrames >>= maybe
+      (error $ "invalid count of frames " ++ show nFrames)
+      (\err -> unless (peakError err == 0 && sumSquaresError err < tolerance && clipsErrors err == 0) $
+        error $ "output levels error " ++ show err ++ " for " ++ show nFrames ++ " frames")
+  analyzeOutputLevels (-1) >>= maybe
+    (return ())
+    (const $ error "expected an invalid count of frames")
+ where
+  tolerance = 1e-5
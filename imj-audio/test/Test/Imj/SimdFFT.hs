@@ -0,0 +1,22 @@
+module Test.Imj.SimdFFT
+          ( testSimdFFT
+          ) where
+
+import           Control.Monad(forM_, unless)
+
+import           Imj.Audio.FFT
+
+testSimdFFT :: IO ()
+testSimdFFT = do
+  getFFTInstructionSet >>= putStrLn . ("SIMD FFT instruction set: " ++) . show
+  forM_ sizes $ \n ->
+    analyzeFFTError n >>= maybe
+      (error $ "invalid FFT size " ++ show n)
+      (\err -> unless (err < tolerance) $
+        error $ "SIMD FFT error " ++ show err ++ " for size " ++ show n)
+  analyzeFFTError 100 >>= maybe
+    (return ())
+    (const $ error "expected an invalid FFT size")
+ where
+  sizes = map (2^) [2..16 :: Int]
+  tolerance = 1e-5
@@ -0,0 +1,25 @@
+module Test.Imj.TabulatedEnvelope
+          ( testTabulatedEnvelope
+          ) where
+
+import           Control.Monad(forM_, unless)
+
+import           Imj.Audio.Envelope
+
+testTabulatedEnvelope :: IO ()
+testTabulatedEnvelope =
+  forM_ [KeyRelease, AutoRelease] $ \mode ->
+    forM_ linearEnvelopes $ \env -> do
+      err <- analyzeTabulatedEnvelopeError mode env
+      unless (err < tolerance) $
+        error $ "tabulated envelope error " ++ show err ++ " for " ++ show (mode, env)
+ where
+  -- for linear releases, the scaled release of the tabulated envelope stays close to the analytic one
+  tolerance = 1e-2
+
+  linearEnvelopes =
+    [ AHDSR'Envelope 401 0 0 401 Linear Linear Linear 1
+    , AHDSR'Envelope 100 20 2000 500 Linear Linear Linear 0.5
+    , AHDSR'Envelope 5000 1000 300 10000 Linear Linear Linear 0.1
+    , AHDSR'Envelope 100 20 2000 500 (Eased EaseIn Ord2) (Eased EaseOut Sine) Linear 0.7
+    ]
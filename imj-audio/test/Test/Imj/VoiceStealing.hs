@@ -0,0 +1,45 @@
+module Test.Imj.VoiceStealing
+          ( testVoiceStealing
+          ) where
+
+import           Control.Monad(unless)
+
+import           Imj.Audio.Envelope
+import           Imj.Audio.Output
+
+testVoiceStealing :: IO ()
+testVoiceStealing = do
+  -- the oldest voice is stolen
+  expect StealOldest KeyRelease voices 3 70 3000 $ Just 0
+  -- no voice is stolen while a channel is free
+  expect StealOldest KeyRelease voices 8 70 3000 Nothing
+  -- the voice in its attack phase is quieter than the voices in their sustain phase
+  expect StealQuietest KeyRelease voices 3 70 3000 $ Just 2
+  -- the levels are estimated at the MIDI time of the new note
+  expect StealQuietest KeyRelease twoVoices 2 70 1100 $ Just 1
+  -- the voice with the same pitch is retriggered, even when a channel is free
+  expect RetriggerSamePitch KeyRelease voices 3 62 3000 $ Just 1
+  expect RetriggerSamePitch KeyRelease voices 8 62 3000 $ Just 1
+  -- else, the notes of a chord are added while a channel is free,
+  -- and the oldest voice is stolen when no channel is free
+  expect RetriggerSamePitch KeyRelease voices 8 65 3000 Nothing
+  expect RetriggerSamePitch KeyRelease voices 3 65 3000 $ Just 0
+  -- voices that ignore note off events can be stolen too
+  expect StealOldest AutoRelease twoVoices 2 70 1100 $ Just 0
+  expect NoVoiceStealing KeyRelease voices 3 70 3000 Nothing
+  expect StealOldest KeyRelease [] 0 70 3000 Nothing
+ where
+  env = AHDSR'Envelope 1000 0 1000 500 Linear Linear Linear 0.5
+  voices =
+    [ HeldVoice 60 1 0
+    , HeldVoice 62 0.6 100
+    , HeldVoice 64 0.8 2800
+    ]
+  twoVoices =
+    [ HeldVoice 60 1 0
+    , HeldVoice 62 1 1000
+    ]
+  expect policy mode vs maxVoices pitch now expected = do
+    res <- analyzeVoiceStealing policy mode env vs maxVoices pitch now
+    unless (res == expected) $
+      error $ "voice stealing " ++ show (policy, mode, maxVoices, pitch, now) ++ ": expected " ++ show expected ++ ", got " ++ show res